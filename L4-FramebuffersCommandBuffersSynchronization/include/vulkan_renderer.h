@@ -55,6 +55,8 @@ private:
 
     std::vector<VkSemaphore> m_imageAvailable, m_renderFinished;
     std::vector<VkFence> m_drawFences;
+    // Fence of the frame that last used each swapchain image (and so its command buffer), null if none yet
+    std::vector<VkFence> m_imagesInFlight;
 
     void createInstance();
     bool checkInstanceExtensionSupport(const std::vector<const char*>& tocheck) const;
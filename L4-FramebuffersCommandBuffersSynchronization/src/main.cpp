@@ -6,7 +6,6 @@
 #include <vector>
 #include <iostream>
 #include <stdlib.h>
-#include <thread>
 
 #include "vulkan_renderer.h"
 
@@ -27,10 +26,6 @@ int main()
     {
         glfwPollEvents();
         vkrender.draw();
-
-        // Needed to prevent simultaneous use of command buffers
-        // Seems like image isn't being locked until some time after it is acquired
-        std::this_thread::sleep_for(std::chrono::milliseconds(3));
     }
 
     vkrender.destroy();
@@ -43,11 +43,6 @@ void VulkanRenderer::draw()
         VK_TRUE,
         std::numeric_limits<uint64_t>::max()
     );
-    vkResetFences(                              // after passing through the fence we need to close to fence
-        m_device.logical,
-        1,
-        &m_drawFences[m_currentFrame]
-    );
 
     // GET NEXT IMAGE
     uint32_t nextImage;
@@ -60,6 +55,22 @@ void VulkanRenderer::draw()
         &nextImage
     );
 
+    // Our fence only covers this frame slot, the image (and its command buffer) can still be in use
+    // by the other slot's frame so wait for that one too
+    if (m_imagesInFlight[nextImage] != VK_NULL_HANDLE)
+    {
+        vkWaitForFences(m_device.logical, 1, &m_imagesInFlight[nextImage], VK_TRUE, std::numeric_limits<uint64_t>::max());
+    }
+    m_imagesInFlight[nextImage] = m_drawFences[m_currentFrame];
+
+    // Only close the fence now, the image may have been tracked by this same fence and waiting on a
+    // closed fence that nothing will signal would hang
+    vkResetFences(                              // after passing through the fence we need to close to fence
+        m_device.logical,
+        1,
+        &m_drawFences[m_currentFrame]
+    );
+
     // SUBMIT COMMAND BUFFER TO COMMAND QUEUE
     VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};   // we can run everything up to the point where we start writing out colors out before the framebuffer is ready
     VkSubmitInfo submitInfo =
@@ -986,6 +997,7 @@ void VulkanRenderer::createSynchronization()
     m_imageAvailable.resize(MAX_FRAME_DRAWS);
     m_renderFinished.resize(MAX_FRAME_DRAWS);
     m_drawFences.resize(MAX_FRAME_DRAWS);
+    m_imagesInFlight.resize(m_swapchainImages.size(), VK_NULL_HANDLE);
 
     VkSemaphoreCreateInfo semInfo =
     {
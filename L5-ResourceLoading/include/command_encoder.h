@@ -0,0 +1,108 @@
+#ifndef COMMAND_ENCODER_H_
+#define COMMAND_ENCODER_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+const uint32_t MAX_TRACKED_VERTEX_BINDINGS = 16;
+const uint32_t MAX_TRACKED_DESCRIPTOR_SETS = 8;
+const uint32_t MAX_TRACKED_PUSH_CONSTANT_BYTES = 128;  // the minimum maxPushConstantsSize
+
+// State changing calls the encoder filters
+enum class EncoderCall
+{
+    Pipeline,
+    VertexBuffers,
+    IndexBuffer,
+    DescriptorSets,
+    PushConstants,
+    Count
+};
+
+struct EncoderStats
+{
+    std::array<uint64_t, size_t(EncoderCall::Count)> issued{}, elided{};
+
+    EncoderStats& operator+=(const EncoderStats& other);
+};
+
+// Thin layer over a VkCommandBuffer that remembers what's bound and drops binds and push constants
+// that wouldn't change anything, so draw loops can bind everything they need per draw for free
+// Draws go straight through. Not thread safe, one encoder per command buffer being recorded
+class CommandEncoder
+{
+public:
+    CommandEncoder() {}
+
+    // Start tracking a command buffer that was just begun (nothing is bound in a new command buffer,
+    // secondaries included). Stats keep adding up over every command buffer
+    void begin(VkCommandBuffer cmd);
+    VkCommandBuffer getCommandBuffer() const;
+
+    void bindPipeline(VkPipelineBindPoint bindPoint, VkPipeline pipeline);
+    void bindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* buffers, const VkDeviceSize* offsets);
+    void bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType);
+    void bindDescriptorSets(
+        VkPipelineBindPoint bindPoint,
+        VkPipelineLayout layout,
+        uint32_t firstSet,
+        uint32_t setCount,
+        const VkDescriptorSet* sets,
+        uint32_t dynamicOffsetCount = 0,
+        const uint32_t* dynamicOffsets = nullptr
+    );
+    void pushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset, uint32_t size, const void* values);
+
+    void drawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
+    void drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+    void drawIndexedIndirectCount(VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride);
+
+    const EncoderStats& getStats() const;
+private:
+    struct VertexBinding
+    {
+        VkBuffer buffer{VK_NULL_HANDLE};
+        VkDeviceSize offset{0};
+    };
+
+    // Dynamic offsets can't be split up per set without knowing the set layouts, so they are
+    // kept for the whole call on its first set
+    struct DescriptorSetBinding
+    {
+        VkDescriptorSet set{VK_NULL_HANDLE};
+        uint32_t firstOfCall{0};
+        std::vector<uint32_t> dynamicOffsets;
+    };
+
+    // Graphics and compute binds don't affect each other
+    struct BindPointState
+    {
+        VkPipeline pipeline{VK_NULL_HANDLE};
+        VkPipelineLayout setLayout{VK_NULL_HANDLE};     // layout the bound sets were bound with
+        std::array<DescriptorSetBinding, MAX_TRACKED_DESCRIPTOR_SETS> sets;
+    };
+
+    VkCommandBuffer m_cmd{VK_NULL_HANDLE};
+    std::array<BindPointState, 2> m_bindPoints;
+    std::array<VertexBinding, MAX_TRACKED_VERTEX_BINDINGS> m_vertexBindings;
+    VkBuffer m_indexBuffer{VK_NULL_HANDLE};
+    VkDeviceSize m_indexOffset{0};
+    VkIndexType m_indexType{VK_INDEX_TYPE_UINT32};
+
+    // Last value pushed to each byte and the stages it was pushed for (0 = never pushed)
+    VkPipelineLayout m_pushLayout{VK_NULL_HANDLE};
+    std::array<uint8_t, MAX_TRACKED_PUSH_CONSTANT_BYTES> m_pushValues{};
+    std::array<VkShaderStageFlags, MAX_TRACKED_PUSH_CONSTANT_BYTES> m_pushStages{};
+
+    EncoderStats m_stats;
+
+    BindPointState* getBindPoint(VkPipelineBindPoint bindPoint);
+    // Counts the call and returns true if it has to be issued
+    bool count(EncoderCall call, bool redundant);
+};
+
+#endif
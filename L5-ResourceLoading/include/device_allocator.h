@@ -0,0 +1,104 @@
+#ifndef DEVICE_ALLOCATOR_H_
+#define DEVICE_ALLOCATOR_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <vector>
+
+#include "range_allocator.h"
+#include "memory_types.h"
+#include "memory_tracker.h"
+
+const VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024; // size of each VkDeviceMemory block we sub-allocate from
+
+// A sub-range of a VkDeviceMemory block (or a dedicated VkDeviceMemory for large resources)
+struct Allocation
+{
+    VkDeviceMemory memory{VK_NULL_HANDLE};
+    VkDeviceSize offset{0};
+    VkDeviceSize size{0};
+    void* mapped{nullptr};      // host pointer to offset (only set for host visible memory)
+    uint32_t memoryType{0};
+    uint32_t block{0};          // index into the block list of memoryType (DEDICATED_BLOCK if not sub-allocated)
+};
+
+const uint32_t DEDICATED_BLOCK = UINT32_MAX;
+
+// Keeps a few large VkDeviceMemory blocks per memory type and hands out ranges of them
+// so we stay well below maxMemoryAllocationCount no matter how many buffers we create
+class DeviceAllocator
+{
+public:
+    DeviceAllocator() {}
+
+    void init(
+        VkPhysicalDevice physical,
+        VkDevice logical,
+        const VkAllocationCallbacks* hostAllocator,
+        bool budgetExtension,
+        bool deviceAddress,     // bufferDeviceAddress is enabled, all memory is allocated so buffers in it can have addresses
+        VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE
+    );
+    void destroy();
+
+    // Tries each preference in order and takes the first memory type that has room (in a block or in its heap budget)
+    Allocation allocate(const VkMemoryRequirements& reqs, const MemoryPreferences& preferences, ResourceKind kind);
+    void free(Allocation& allocation);
+
+    void createBuffer(
+        VkDeviceSize bufferSize,
+        VkBufferUsageFlags usageFlags,
+        const MemoryPreferences& bufferProperties,
+        VkBuffer* buffer,
+        Allocation* allocation,
+        const char* owner       // shows up in the memory usage/leak reports
+    );
+    void destroyBuffer(VkBuffer buffer, Allocation& allocation);
+
+    void createImage(
+        const VkImageCreateInfo& imageInfo,
+        const MemoryPreferences& imageProperties,
+        VkImage* image,
+        Allocation* allocation,
+        const char* owner
+    );
+    void destroyImage(VkImage image, Allocation& allocation);
+
+    // Only with deviceAddress set at init and for buffers created with SHADER_DEVICE_ADDRESS usage
+    bool hasDeviceAddress() const;
+    VkDeviceAddress getBufferAddress(VkBuffer buffer) const;
+
+    const MemoryTypeSelector& getMemoryTypes() const;
+    // Usage of everything created through createBuffer/createImage
+    const MemoryTracker& getTracker() const;
+
+private:
+    struct MemoryBlock
+    {
+        VkDeviceMemory memory{VK_NULL_HANDLE}; // VK_NULL_HANDLE if this slot was released and can be reused
+        void* mapped{nullptr};
+        RangeAllocator ranges;
+    };
+
+    VkPhysicalDevice m_physicalDevice;
+    VkDevice m_logicalDevice;
+    const VkAllocationCallbacks* m_hostAllocator;
+    VkDeviceSize m_blockSize{DEFAULT_BLOCK_SIZE};
+    VkDeviceSize m_granularity{1};
+    bool m_deviceAddress{false};
+    MemoryTypeSelector m_memoryTypes;
+    MemoryTracker m_tracker;
+    std::array<std::vector<MemoryBlock>, VK_MAX_MEMORY_TYPES> m_blocks;
+
+    bool allocateFromBlocks(uint32_t memoryType, const VkMemoryRequirements& reqs, ResourceKind kind, Allocation* allocation);
+    // VK_NULL_HANDLE if the driver is out of memory of that type
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped);
+    void freeDeviceMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType);
+    VkDeviceSize getBlockSize(uint32_t memoryType);
+    // false if the driver is out of memory of that type
+    bool createBlock(uint32_t memoryType);
+};
+
+#endif
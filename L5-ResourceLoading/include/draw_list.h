@@ -0,0 +1,66 @@
+#ifndef DRAW_LIST_H_
+#define DRAW_LIST_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "device_allocator.h"
+#include "per_frame_buffer.h"
+
+const uint32_t DEFAULT_DRAW_CAPACITY = 64 * 1024;
+
+typedef uint32_t DrawHandle;
+
+// Tightly packed VkDrawIndexedIndirectCommands for everything in the scene, so drawing all of it is
+// one vkCmdDrawIndexedIndirect no matter how many meshes there are
+//
+// Commands are changed in place: adding appends, removing moves the last command into the hole, and
+// only what changed gets written to the GPU (every frame in flight has its own copy, see PerFrameBuffer)
+//
+// Every command has a bounding sphere next to it (in a second buffer, same index) for culling on the GPU
+class DrawList
+{
+public:
+    DrawList() {}
+
+    void init(DeviceAllocator* allocator, uint32_t frameCount, uint32_t capacity = DEFAULT_DRAW_CAPACITY);
+    void destroy();
+
+    // bounds is a sphere, xyz centre and w radius
+    DrawHandle add(const VkDrawIndexedIndirectCommand& command, const glm::vec4& bounds);
+    // The bounds stay as they were
+    void update(DrawHandle handle, const VkDrawIndexedIndirectCommand& command);
+    void setBounds(DrawHandle handle, const glm::vec4& bounds);
+    const VkDrawIndexedIndirectCommand& get(DrawHandle handle) const;
+    void remove(DrawHandle handle);
+
+    // Number of commands in the buffer (they always start at offset 0)
+    uint32_t getCount() const;
+    uint32_t getCapacity() const;
+
+    // Bring frameIndex's copy of the buffer up to date and return it, only once that frame's
+    // previous use has completed
+    VkDescriptorBufferInfo prepareFrame(uint32_t frameIndex);
+    // The buffers of one frame, the same ones for the lifetime of the list
+    VkDescriptorBufferInfo getCommandBuffer(uint32_t frameIndex) const;
+    VkDescriptorBufferInfo getBoundsBuffer(uint32_t frameIndex) const;
+private:
+    uint32_t m_capacity;
+    PerFrameBuffer m_commandBuffer;
+    PerFrameBuffer m_boundsBuffer;
+
+    std::vector<VkDrawIndexedIndirectCommand> m_commands;
+    std::vector<glm::vec4> m_bounds;
+    std::vector<uint32_t> m_slotOfHandle;       // handle -> index in m_commands
+    std::vector<DrawHandle> m_handleOfSlot;     // index in m_commands -> handle
+    std::vector<DrawHandle> m_freeHandles;
+
+    void markDirty(uint32_t slot);
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef DRAW_SORT_H_
+#define DRAW_SORT_H_
+
+#include <cstdint>
+#include <vector>
+
+// Layout of a draw sort key, most significant field first so sorting by key groups draws by pass,
+// then pipeline, then material, then mesh (fewest expensive state changes) and orders what's left
+// front to back
+const uint32_t SORT_KEY_PASS_BITS = 4;
+const uint32_t SORT_KEY_PIPELINE_BITS = 12;
+const uint32_t SORT_KEY_MATERIAL_BITS = 16;
+const uint32_t SORT_KEY_MESH_BITS = 16;
+const uint32_t SORT_KEY_DEPTH_BITS = 16;
+
+// A draw to record and the key it's ordered by, index is whatever the caller uses to find the draw
+struct SortedDraw
+{
+    uint64_t key;
+    uint32_t index;
+};
+
+// Fields wider than their bits are truncated, depth is clamped to 0..1 (0 = near)
+uint64_t makeSortKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+
+// Stable LSD radix sort on the keys, a byte per pass. All the byte histograms are built in one read
+// of the draws and bytes every key has in common are skipped, so most frames need only a few passes
+// scratch is only there so its memory can be reused from frame to frame
+void sortDraws(std::vector<SortedDraw>& draws, std::vector<SortedDraw>& scratch);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef FRUSTUM_CULLER_H_
+#define FRUSTUM_CULLER_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "device_allocator.h"
+#include "draw_list.h"
+
+const uint32_t CULL_GROUP_SIZE = 64;    // has to match local_size_x in cull.comp
+
+// Compute pre-pass that tests the bounding sphere of every command in a DrawList against the view
+// frustum and packs the survivors into a second indirect buffer, along with how many there are
+// Draw them with vkCmdDrawIndexedIndirectCount, the CPU never learns what was visible
+class FrustumCuller
+{
+public:
+    FrustumCuller() {}
+
+    // Reads drawList's buffers, so it has to outlive us
+    void init(VkDevice device, const VkAllocationCallbacks* hostAllocator, DeviceAllocator* allocator, DrawList* drawList, uint32_t frameCount);
+    void destroy();
+
+    // Record the culling of frameIndex's draw list into cmd, outside a render pass and after the
+    // list has been prepared for the frame. Indirect reads of the results are synchronised
+    void record(VkCommandBuffer cmd, uint32_t frameIndex, const glm::mat4& viewProj);
+
+    // Visible draws packed from offset 0, and their count as a uint32_t
+    VkBuffer getVisibleDraws(uint32_t frameIndex) const;
+    VkBuffer getVisibleCount(uint32_t frameIndex) const;
+private:
+    // Same layout as the push_constant block in cull.comp
+    struct PushConstants
+    {
+        glm::vec4 planes[6];    // xyz normal pointing inside, w distance
+        uint32_t drawCount;
+    };
+
+    struct FrameBuffers
+    {
+        VkBuffer draws, count;
+        Allocation drawsMemory, countMemory;
+        VkDescriptorSet set;
+    };
+
+    VkDevice m_device;
+    const VkAllocationCallbacks* m_hostAllocator;
+    DeviceAllocator* m_allocator;
+    DrawList* m_drawList;
+
+    VkDescriptorSetLayout m_setLayout;
+    VkDescriptorPool m_descriptorPool;
+    VkPipelineLayout m_pipelineLayout;
+    VkPipeline m_pipeline;
+
+    std::vector<FrameBuffers> m_frames;
+
+    void createPipeline();
+    void createFrameBuffers(uint32_t frameCount);
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef GEOMETRY_POOL_H_
+#define GEOMETRY_POOL_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "utilities.h"
+#include "device_allocator.h"
+#include "range_allocator.h"
+#include "transfer_context.h"
+
+const uint32_t DEFAULT_VERTEX_CAPACITY = 1024 * 1024;      // vertices
+const uint32_t DEFAULT_INDEX_CAPACITY = 4 * 1024 * 1024;   // indices
+const VkDeviceSize DEFAULT_DEFRAG_BUDGET = 1024 * 1024;    // bytes moved per frame at most
+
+// Host side cost of the two upload paths, staged time only covers recording the copies (the GPU part
+// runs later on the transfer queue) so compare it against direct time plus the wait on the token
+struct UploadStats
+{
+    uint64_t directUploads{0}, directBytes{0};
+    uint64_t stagedUploads{0}, stagedBytes{0};
+    double directSeconds{0.0}, stagedSeconds{0.0};
+};
+
+// Where a piece of geometry currently lives in the pool, this changes when the pool is defragmented
+struct GeometryRange
+{
+    uint32_t firstVertex, vertexCount;
+    uint32_t firstIndex, indexCount;
+};
+
+typedef uint32_t GeometryHandle;
+
+// All vertex data lives in one big vertex buffer and all index data in one big index buffer
+// Meshes only own ranges of them so drawing everything needs a single bind of each
+//
+// Ranges are referenced through handles so they can be moved: each frame a little of the live data
+// is copied down into holes on the GPU (in the frame's own submission, no idling) until the pool is
+// packed again. Freed and moved-from ranges are only reused once no frame in flight can read them
+class GeometryPool
+{
+public:
+    GeometryPool() {}
+
+    void init(
+        DeviceAllocator* allocator,
+        uint32_t vertexCapacity = DEFAULT_VERTEX_CAPACITY,
+        uint32_t indexCapacity = DEFAULT_INDEX_CAPACITY
+    );
+    void destroy();
+
+    GeometryHandle allocate(uint32_t vertexCount, uint32_t indexCount);
+    // The ranges stay reserved until every frame up to now has completed
+    void free(GeometryHandle handle);
+    const GeometryRange& getRange(GeometryHandle handle) const;
+    // A single instance indirect draw of the whole range
+    VkDrawIndexedIndirectCommand getDrawCommand(GeometryHandle handle) const;
+    // Handles not freed yet and the bytes of the pool in use (including ranges waiting to be reused)
+    uint32_t getLiveCount() const;
+    VkDeviceSize getUsedBytes() const;
+
+    // Fill a range with data, either written straight into the pool memory when it's host visible
+    // (unified memory) or staged and copied through transfer
+    void uploadVertices(TransferContext* transfer, GeometryHandle handle, const Vertex* vertices);
+    void uploadIndices(TransferContext* transfer, GeometryHandle handle, const uint32_t* indices);
+
+    // Call once per frame before anything else, frame numbers increase and completedFrame is the
+    // newest frame whose GPU work is known to be done
+    void beginFrame(uint64_t frame, uint64_t completedFrame);
+
+    // Record copies moving at most byteBudget of live data down into free space, cmd has to be
+    // submitted on the graphics queue ahead of this frame's draws
+    // Staged uploads to the pool must have completed before this is called
+    // Returns true if anything moved, draws recorded before that use stale offsets until re-recorded
+    bool defragment(VkCommandBuffer cmd, VkDeviceSize byteBudget = DEFAULT_DEFRAG_BUDGET);
+    // Bumped by every defragment call that moved something
+    uint64_t getVersion() const;
+    // Handles whose ranges the last defragment call moved (a handle can be listed twice, vertices and indices)
+    const std::vector<GeometryHandle>& getMovedHandles() const;
+    // Every draw recorded before version has been re-recorded, so the old copies can be let go
+    void releaseMoves(uint64_t version);
+
+    // Direct writes are on by default where the memory allows it, turning them off forces the staged path
+    // (e.g. to benchmark both paths on the same device)
+    bool canWriteDirect() const;
+    void setDirectWrite(bool enable);
+    const UploadStats& getUploadStats() const;
+
+    VkBuffer getVertexBuffer();
+    VkBuffer getIndexBuffer();
+    // Address of the first vertex of the pool for vertex pulling (gl_VertexIndex already includes the
+    // draw's vertexOffset), only when the allocator has device addresses
+    VkDeviceAddress getVertexAddress();
+private:
+    // The vertex and index halves of the pool are handled the same way
+    struct Region
+    {
+        VkBuffer buffer;
+        Allocation memory;
+        RangeAllocator ranges;                          // in bytes
+        VkDeviceSize stride;
+        std::map<VkDeviceSize, GeometryHandle> owners;  // byte offset -> handle living there
+    };
+
+    struct RetiredRange
+    {
+        Region* region;
+        VkDeviceSize offset;
+        uint64_t when;      // frame that has to complete (or version that has to be recorded for moves)
+    };
+
+    DeviceAllocator* m_allocator;
+    Region m_vertices, m_indices;
+
+    std::vector<GeometryRange> m_handles;
+    std::vector<GeometryHandle> m_freeHandles;
+
+    uint64_t m_frame{0};
+    uint64_t m_version{0};
+    std::deque<RetiredRange> m_retired;     // waiting for their frame to complete
+    std::deque<RetiredRange> m_movedFrom;   // waiting for draws to stop pointing at them
+    bool m_compact{true};                   // nothing could move last time and nothing was freed since
+    std::vector<GeometryHandle> m_moved;    // by the last defragment call
+
+    bool m_directWrite{false};
+    UploadStats m_stats;
+
+    void createRegion(Region& region, VkDeviceSize stride, uint32_t capacity, VkBufferUsageFlags usage, const MemoryPreferences& prefs, const char* owner);
+    bool allocateRange(Region& region, uint32_t count, GeometryHandle handle, uint32_t* first);
+    void retireRange(Region& region, uint32_t first, uint32_t count);
+    VkDeviceSize defragmentRegion(Region& region, VkDeviceSize byteBudget, std::vector<VkBufferCopy>& copies);
+
+    void upload(TransferContext* transfer, const void* data, VkDeviceSize size, Region& region, VkDeviceSize dstOffset);
+};
+
+#endif
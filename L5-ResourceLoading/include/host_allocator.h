@@ -0,0 +1,102 @@
+#ifndef HOST_ALLOCATOR_H_
+#define HOST_ALLOCATOR_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+const size_t DEFAULT_ARENA_CHUNK_SIZE = 64 * 1024;
+const uint32_t HOST_ALLOCATION_SCOPES = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+// What the driver did with host memory in one VkSystemAllocationScope
+struct HostScopeStats
+{
+    uint64_t allocations{0}, reallocations{0}, frees{0};
+    uint64_t liveBytes{0}, peakBytes{0}, totalBytes{0};
+    uint64_t internalBytes{0};  // memory the driver allocated itself and only told us about
+};
+
+// VkAllocationCallbacks for all driver host allocations, picked by how long the memory lives:
+// - command/device/instance scope come from bump arenas, a chunk is recycled once everything in it is freed
+// - object/cache scope come from power of two size class pools with free lists
+// - anything too big for either goes straight to malloc
+// Every allocation has a small header in front of it so free knows where it came from
+class HostAllocator
+{
+public:
+    HostAllocator() {}
+
+    void init(size_t arenaChunkSize = DEFAULT_ARENA_CHUNK_SIZE);
+    // Only once everything created with the callbacks is gone (i.e. after vkDestroyInstance)
+    void destroy();
+
+    // Pass to every vkCreate*/vkDestroy*/vkAllocate*/vkFree*
+    const VkAllocationCallbacks* getCallbacks() const;
+
+    HostScopeStats getStats(VkSystemAllocationScope scope) const;
+private:
+    // Lives right in front of every pointer handed out
+    struct alignas(16) Header
+    {
+        void* base;         // what to give back to the arena chunk/pool/malloc
+        void* chunk;        // arena chunk it came from (arena allocations only)
+        size_t size;
+        uint32_t scope;
+        uint32_t sizeClass; // pool size class, or one of the kinds below
+    };
+    static const uint32_t ARENA_ALLOCATION = UINT32_MAX - 1;
+    static const uint32_t LARGE_ALLOCATION = UINT32_MAX;
+
+    struct ArenaChunk
+    {
+        char* memory;
+        size_t used;
+        size_t live;        // allocations not freed yet
+    };
+
+    struct Arena
+    {
+        ArenaChunk* current{nullptr};
+        std::vector<ArenaChunk*> chunks;    // all of them, including current
+        ArenaChunk* spare{nullptr};         // an empty chunk kept around so we don't malloc on every refill
+    };
+
+    static const uint32_t SIZE_CLASS_COUNT = 8;  // 32, 64, ... 4096 bytes (header included)
+    static const size_t MIN_SIZE_CLASS = 32;
+    static const size_t POOL_SLAB_SIZE = 64 * 1024;
+
+    struct Pool
+    {
+        std::vector<void*> freeSlots;
+        std::vector<char*> slabs;
+    };
+
+    VkAllocationCallbacks m_callbacks;
+    size_t m_arenaChunkSize;
+
+    mutable std::mutex m_mutex;
+    std::array<Arena, HOST_ALLOCATION_SCOPES> m_arenas;
+    std::array<Pool, SIZE_CLASS_COUNT> m_pools;
+    std::array<HostScopeStats, HOST_ALLOCATION_SCOPES> m_stats;
+
+    void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void free(void* memory);
+
+    void* allocateFromArena(Arena& arena, size_t size, size_t alignment, void** chunk, void** base);
+    void freeToArena(Arena& arena, ArenaChunk* chunk);
+    void* allocateFromPool(uint32_t sizeClass);
+
+    static void* VKAPI_PTR allocationCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static void* VKAPI_PTR reallocationCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static void VKAPI_PTR freeCallback(void* userData, void* memory);
+    static void VKAPI_PTR internalAllocationCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+    static void VKAPI_PTR internalFreeCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef INSTANCE_BUFFER_H_
+#define INSTANCE_BUFFER_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "utilities.h"
+#include "device_allocator.h"
+#include "per_frame_buffer.h"
+
+const uint32_t DEFAULT_INSTANCE_CAPACITY = 64 * 1024;
+
+// The per instance vertex stream (binding 1) of every mesh, packed so each mesh's instances are one
+// range that a draw picks with firstInstance/instanceCount
+//
+// Instances change rarely so the whole array is replaced at once, every frame in flight picks the new
+// contents up the next time it's prepared
+class InstanceBuffer
+{
+public:
+    InstanceBuffer() {}
+
+    void init(DeviceAllocator* allocator, uint32_t frameCount, uint32_t capacity = DEFAULT_INSTANCE_CAPACITY);
+    void destroy();
+
+    void write(const std::vector<InstanceData>& instances);
+
+    // Bring frameIndex's copy up to date and return it, only once that frame's previous use has completed
+    VkDescriptorBufferInfo prepareFrame(uint32_t frameIndex);
+private:
+    uint32_t m_capacity;
+    PerFrameBuffer m_buffer;
+
+    std::vector<InstanceData> m_instances;
+};
+
+#endif
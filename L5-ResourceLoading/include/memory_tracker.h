@@ -0,0 +1,63 @@
+#ifndef MEMORY_TRACKER_H_
+#define MEMORY_TRACKER_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class TrackedType
+{
+    Buffer,
+    Image
+};
+
+// One live buffer/image and who asked for it
+struct TrackedResource
+{
+    TrackedType type;
+    uint64_t handle;
+    std::string owner;
+    VkDeviceSize size;
+    uint32_t memoryType, heap;
+    uint64_t serial;    // creation order, so leaks can be matched to what created them
+};
+
+// Running totals for a heap, owner or resource type
+struct MemoryUsage
+{
+    VkDeviceSize bytes{0}, peakBytes{0};
+    uint32_t count{0}, peakCount{0};
+    uint64_t created{0}, destroyed{0};
+};
+
+// Bookkeeping for every resource created through the DeviceAllocator
+// Sizes are what the resources take out of their heap (memory requirements), not what was asked for
+class MemoryTracker
+{
+public:
+    MemoryTracker() {}
+
+    void track(TrackedType type, uint64_t handle, const std::string& owner, VkDeviceSize size, uint32_t memoryType, uint32_t heap);
+    void untrack(TrackedType type, uint64_t handle);
+
+    MemoryUsage getHeapUsage(uint32_t heap) const;
+    MemoryUsage getTypeUsage(TrackedType type) const;
+    const std::map<std::string, MemoryUsage>& getOwnerUsage() const;
+
+    // Everything created and not destroyed yet, oldest first
+    std::vector<TrackedResource> getLiveResources() const;
+private:
+    std::map<std::pair<TrackedType, uint64_t>, TrackedResource> m_live;
+    std::array<MemoryUsage, VK_MAX_MEMORY_HEAPS> m_heaps;
+    std::array<MemoryUsage, 2> m_types;
+    std::map<std::string, MemoryUsage> m_owners;
+    uint64_t m_nextSerial{0};
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef MEMORY_TYPES_H_
+#define MEMORY_TYPES_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <vector>
+
+// Ranked list of acceptable memory property combinations, best first
+// e.g. { DEVICE_LOCAL | HOST_VISIBLE, DEVICE_LOCAL, HOST_VISIBLE | HOST_CACHED }
+typedef std::vector<VkMemoryPropertyFlags> MemoryPreferences;
+
+struct HeapBudget
+{
+    VkDeviceSize budget;    // how much of the heap we can use before the driver starts paging/failing
+    VkDeviceSize usage;     // how much of the heap is in use (by us and everyone else if VK_EXT_memory_budget is on)
+};
+
+// Caches the device memory properties once and picks memory types from a ranked list of preferences
+// while keeping track of how full each heap is so we don't oversubscribe it
+class MemoryTypeSelector
+{
+public:
+    MemoryTypeSelector() {}
+
+    void init(VkPhysicalDevice physical, bool budgetExtension);
+
+    // Re-query heap usage/budget from the driver (only does anything with VK_EXT_memory_budget)
+    void refreshBudget();
+
+    // Memory types allowed by allowedTypes that have all the requested flags
+    // ordered so types with the fewest extra (unrequested) flags come first
+    std::vector<uint32_t> getCandidates(uint32_t allowedTypes, VkMemoryPropertyFlags flags) const;
+    bool hasBudget(uint32_t memoryType, VkDeviceSize size) const;
+
+    void trackAllocation(uint32_t memoryType, VkDeviceSize size);
+    void trackFree(uint32_t memoryType, VkDeviceSize size);
+
+    const VkPhysicalDeviceMemoryProperties& getProperties() const;
+    VkMemoryPropertyFlags getFlags(uint32_t memoryType) const;
+    HeapBudget getHeapBudget(uint32_t heapIndex) const;
+
+    // True if the biggest device local heap can also be mapped by the host (integrated/software devices
+    // or resizable BAR) so device local resources can be written directly instead of staged
+    // A small BAR window next to a bigger VRAM heap doesn't count
+    bool hasUnifiedMemory() const;
+private:
+    VkPhysicalDevice m_physicalDevice;
+    bool m_budgetExtension{false};
+    VkPhysicalDeviceMemoryProperties m_memoryProps;
+
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> m_driverBudget{};     // budget reported at the last refresh
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> m_driverUsage{};      // usage reported at the last refresh
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> m_ownUsage{};         // what we have allocated right now
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> m_ownUsageAtRefresh{};
+};
+
+#endif
@@ -1,4 +1,3 @@
-
 #ifndef MESH_H_
 #define MESH_H_
 
@@ -8,35 +7,68 @@
 #include <vector>
 
 #include "utilities.h"
+#include "geometry_pool.h"
+#include "transfer_context.h"
 
+// A mesh is just a range of the shared vertex/index buffers of a geometry pool
+// The range can move when the pool is defragmented so it is always looked up through the handle
 class Mesh
 {
 public:
     Mesh() {}
     Mesh(
-        VkPhysicalDevice phys,
-        VkDevice log,
-        VkQueue transferQueue,
-        VkCommandPool transferCmdPool,
+        GeometryPool* pool,
+        TransferContext* transfer,
         std::vector<Vertex>* vertices,
         std::vector<uint32_t>* indices
     );
 
     int getVertexCount();
     int getIndexCount();
+    // Arguments for vkCmdDrawIndexed with the pool buffers bound (indices are relative to vertexOffset)
+    uint32_t getFirstIndex();
+    int32_t getVertexOffset();
+    // Every instance of the mesh in one draw, packed for an indirect draw
+    VkDrawIndexedIndirectCommand getDrawCommand();
+    GeometryHandle getGeometry();
+    // Buffers to bind for drawIndexed
     VkBuffer getVertexBuffer();
     VkBuffer getIndexBuffer();
+    // Where the vertices are and how to read them for vertex pulling, the address only when the pool has one
+    VkDeviceAddress getVertexAddress();
+    VertexLayout getVertexLayout();
+    // Bounding sphere around all instances, xyz centre and w radius
+    glm::vec4 getBounds();
+
+    // Model matrix applied on top of every instance, changing it needs no upload (it's a push constant)
+    const glm::mat4& getTransform();
+    void setTransform(const glm::mat4& transform);
+
+    // A mesh is only drawn once it has instances, they are drawn from the renderer's instance buffer
+    // starting at firstInstance (which the renderer sets when it packs the instances of all meshes)
+    void addInstance(const glm::mat4& transform, const glm::vec4& color);
+    const std::vector<InstanceData>& getInstances();
+    uint32_t getFirstInstance();
+    void setFirstInstance(uint32_t firstInstance);
+    // Bytes of the geometry pool this mesh takes up
+    VkDeviceSize getMemoryUsage();
 
     void destroyVertexBuffer();
 private:
     int m_vertexCount, m_indexCount;
-    VkPhysicalDevice m_physicalDevice;
-    VkDevice m_logicalDevice;
-    VkBuffer m_vertexBuffer, m_indexBuffer;
-    VkDeviceMemory m_vertexBufferMemory, m_indexBufferMemory;
+    GeometryPool* m_pool;
+    GeometryHandle m_geometry;
+    glm::vec4 m_bounds;     // of the vertices themselves
+    std::vector<InstanceData> m_instances;
+    glm::mat4 m_transform{1.0f};
+    glm::vec4 m_instanceBounds{0.0f};
+    bool m_instanceBoundsValid{true};   // worked out again on the next getBounds once instances changed
+    uint32_t m_firstInstance{0};
 
-    void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCmdPool, std::vector<Vertex>* vertices);
-    void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCmdPool, std::vector<uint32_t>* indices);
+    // Staged uploads are only recorded into transfer, they happen when the owner of the context submits it
+    void createVertexBuffer(TransferContext* transfer, std::vector<Vertex>* vertices);
+    void createIndexBuffer(TransferContext* transfer, std::vector<uint32_t>* indices);
+    void computeBounds(std::vector<Vertex>* vertices);
 };
 
 #endif
\ No newline at end of file
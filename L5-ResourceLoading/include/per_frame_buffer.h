@@ -0,0 +1,50 @@
+#ifndef PER_FRAME_BUFFER_H_
+#define PER_FRAME_BUFFER_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "device_allocator.h"
+
+// One persistently mapped buffer written by the CPU and read by the GPU, split into a segment per frame
+// in flight so the CPU only ever writes a copy the GPU is done with
+//
+// The data itself belongs to the owner, markDirty records which bytes of it changed and every segment
+// catches up on what it missed the next time its frame is flushed
+// Owners that write every frame from scratch (e.g. UniformRing) write through getMapped instead
+class PerFrameBuffer
+{
+public:
+    PerFrameBuffer() {}
+
+    void init(DeviceAllocator* allocator, uint32_t frameCount, VkDeviceSize frameSize, VkBufferUsageFlags usage, const char* owner);
+    void destroy();
+
+    // Bytes [offset, offset + size) of the owner's data changed
+    void markDirty(VkDeviceSize offset, VkDeviceSize size);
+    // Copy what frameIndex's segment missed out of data, only once that frame's previous use has completed
+    // Changes past size are dropped, that part of the data is no longer in use
+    void flush(uint32_t frameIndex, const void* data, VkDeviceSize size);
+
+    // frameIndex's segment, the same one for the lifetime of the buffer
+    VkDescriptorBufferInfo getFrame(uint32_t frameIndex) const;
+    void* getMapped(uint32_t frameIndex) const;
+    VkBuffer getBuffer() const;
+private:
+    struct Segment
+    {
+        VkDeviceSize offset;
+        VkDeviceSize dirtyBegin{0}, dirtyEnd{0};    // bytes changed since this segment was last flushed
+    };
+
+    DeviceAllocator* m_allocator;
+    VkBuffer m_buffer;
+    Allocation m_memory;
+    VkDeviceSize m_frameSize;
+    std::vector<Segment> m_segments;
+};
+
+#endif
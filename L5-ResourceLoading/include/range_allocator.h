@@ -0,0 +1,59 @@
+#ifndef RANGE_ALLOCATOR_H_
+#define RANGE_ALLOCATOR_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <map>
+#include <set>
+#include <utility>
+
+// Linear resources (buffers, linear images) and optimal resources (optimal images)
+// must not share a bufferImageGranularity "page" when placed next to each other
+enum class ResourceKind
+{
+    Linear,
+    Optimal
+};
+
+// Hands out sub-ranges of [0, size) (e.g. a VkDeviceMemory block or a large VkBuffer)
+// Free ranges are kept coalesced so allocate is best-fit and free is O(log n)
+class RangeAllocator
+{
+public:
+    RangeAllocator() {}
+    RangeAllocator(VkDeviceSize size, VkDeviceSize granularity = 1);
+
+    // Returns false if no free range can hold the request
+    bool allocate(VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind, VkDeviceSize* offset);
+    // Lowest addressed placement that ends at or before limit (for compacting towards the start)
+    bool allocateBelow(VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind, VkDeviceSize limit, VkDeviceSize* offset);
+    void free(VkDeviceSize offset);
+
+    VkDeviceSize getSize() const;
+    VkDeviceSize getUsed() const;
+    bool isEmpty() const;
+    // End of the highest used range, anything free below it is fragmentation
+    VkDeviceSize getUsedEnd() const;
+    // The used range with the highest offset below limit
+    bool findUsedBelow(VkDeviceSize limit, VkDeviceSize* offset, VkDeviceSize* size) const;
+private:
+    struct UsedRange
+    {
+        VkDeviceSize size;
+        ResourceKind kind;
+    };
+
+    VkDeviceSize m_size{0}, m_used{0}, m_granularity{1};
+    std::map<VkDeviceSize, VkDeviceSize> m_free;                // offset -> size (ordered for coalescing)
+    std::set<std::pair<VkDeviceSize, VkDeviceSize>> m_freeBySize; // (size, offset) (ordered for best fit)
+    std::map<VkDeviceSize, UsedRange> m_usedRanges;             // offset -> range
+
+    // Where a request would start inside the free range [freeStart, freeEnd), if it fits at all
+    bool fit(VkDeviceSize freeStart, VkDeviceSize freeEnd, VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind, VkDeviceSize* start) const;
+    void take(VkDeviceSize freeStart, VkDeviceSize freeEnd, VkDeviceSize start, VkDeviceSize size, ResourceKind kind);
+    void insertFree(VkDeviceSize offset, VkDeviceSize size);
+    void eraseFree(std::map<VkDeviceSize, VkDeviceSize>::iterator it);
+};
+
+#endif
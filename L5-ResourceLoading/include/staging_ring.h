@@ -0,0 +1,63 @@
+#ifndef STAGING_RING_H_
+#define STAGING_RING_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <deque>
+
+#include "device_allocator.h"
+
+const VkDeviceSize DEFAULT_STAGING_SIZE = 16 * 1024 * 1024;
+
+// A piece of the staging ring the host can write to and the GPU can copy from
+struct StagingRegion
+{
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void* mapped;
+};
+
+// One persistently mapped host visible buffer that all uploads are staged through
+// Regions are handed out in order and come back once the transfer that read them has completed
+class StagingRing
+{
+public:
+    StagingRing() {}
+
+    void init(DeviceAllocator* allocator, VkDevice logical, VkDeviceSize size = DEFAULT_STAGING_SIZE);
+    void destroy();
+
+    // Reserve up to size bytes, the region may be smaller than asked for (so big uploads go in chunks)
+    // unless allowPartial is false, and is empty if not enough of the ring has been reclaimed yet
+    StagingRegion reserve(VkDeviceSize size, VkDeviceSize alignment = 16, bool allowPartial = true);
+
+    // Everything reserved since the last retire is read by the transfer with this (increasing) token value
+    void retire(uint64_t token);
+
+    // Give back regions of every transfer up to and including completedToken
+    void reclaim(uint64_t completedToken);
+
+    VkDeviceSize getSize() const;
+private:
+    struct InFlight
+    {
+        VkDeviceSize end;   // head of the ring when this was retired
+        VkDeviceSize bytes; // bytes reserved (including wrap padding) since the previous retire
+        uint64_t token;
+    };
+
+    DeviceAllocator* m_allocator;
+    VkDevice m_logicalDevice;
+    VkBuffer m_buffer;
+    Allocation m_memory;
+
+    VkDeviceSize m_size{0};
+    VkDeviceSize m_head{0}, m_tail{0};  // we write at head, the oldest in flight data starts at tail
+    VkDeviceSize m_used{0};             // bytes between tail and head
+    VkDeviceSize m_pending{0};          // bytes reserved but not yet retired
+    std::deque<InFlight> m_inFlight;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TIMELINE_H_
+#define TIMELINE_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+
+// A Vulkan 1.2 timeline semaphore counting the submissions of one queue
+// Every submit to the queue, whoever makes it, signals the next value, so "is submission n done" is a
+// single compare against the counter and one semaphore stands in for a fence per submission. The host
+// can poll it, block on it, and other queues can wait on any value of it
+class Timeline
+{
+public:
+    Timeline() {}
+
+    void init(VkDevice logical, const VkAllocationCallbacks* hostAllocator);
+    // Only once nothing submitted can still signal it
+    void destroy();
+
+    VkSemaphore getSemaphore() const;
+
+    // Value for the next submission to signal, values have to be submitted in the order they're handed out
+    // so nothing else may submit to the queue between taking a value and submitting with it
+    uint64_t next();
+    // Newest value handed out so far (0 before the first)
+    uint64_t getLast() const;
+
+    // Newest value the GPU has reached, the driver is only asked when the cached value is behind
+    uint64_t getCompleted();
+    // The driver is asked whenever value is past the cached one
+    bool isComplete(uint64_t value);
+    // Block until value has been reached
+    void wait(uint64_t value);
+private:
+    VkDevice m_logicalDevice;
+    const VkAllocationCallbacks* m_hostAllocator;
+    VkSemaphore m_semaphore{VK_NULL_HANDLE};
+
+    uint64_t m_last{0};
+    uint64_t m_completed{0};
+
+    void readCounter();
+};
+
+#endif
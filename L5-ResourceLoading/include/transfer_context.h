@@ -0,0 +1,108 @@
+#ifndef TRANSFER_CONTEXT_H_
+#define TRANSFER_CONTEXT_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <deque>
+#include <vector>
+
+#include "staging_ring.h"
+#include "timeline.h"
+
+// Handle to one submitted batch of transfers, tokens complete in the order they were handed out
+struct TransferToken
+{
+    uint64_t value{0};
+};
+
+// Collects any number of buffer/image copies into one command buffer and submits them together
+// so loading N meshes costs one submit instead of a queue drain per copy
+// Each batch signals the next value of the timeline of the queue it went to, the token is that value
+//
+// If the transfer queue is from a different family than the graphics queue everything written
+// is released to the graphics family at the end of the batch and acquired on the graphics queue
+// once the copies are done, so uploads run alongside rendering instead of in front of it
+// The acquire is a graphics queue submission like any other and signals the next value of the graphics
+// queue's timeline (owned by the renderer), a token is complete once both values have been reached
+class TransferContext
+{
+public:
+    TransferContext() {}
+
+    void init(
+        VkDevice logical,
+        const VkAllocationCallbacks* hostAllocator,
+        VkQueue transferQueue,
+        uint32_t transferFamily,
+        VkQueue gfxQueue,
+        uint32_t gfxFamily,
+        Timeline* gfxTimeline,
+        StagingRing* stagingRing
+    );
+    void destroy();
+
+    // Stage data through the ring and copy it to dstBuffer (big uploads are split into chunks)
+    void upload(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset = 0);
+    // Stage data through the ring and copy it to an image already in dstLayout (must fit in the ring)
+    void uploadImage(const void* data, VkDeviceSize size, VkImage dstImage, VkImageLayout dstLayout, VkBufferImageCopy region);
+
+    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, const VkBufferCopy& region);
+    void copyBufferToImage(VkBuffer srcBuffer, VkImage dstImage, VkImageLayout dstLayout, const VkBufferImageCopy& region);
+
+    // Command buffer of the batch being recorded, for barriers/layout transitions around the copies
+    VkCommandBuffer getCommandBuffer();
+
+    // Submit everything recorded since the last submit, returns a token that completes once
+    // the data can be used on the graphics queue
+    TransferToken submit();
+    bool isComplete(TransferToken token);
+    void wait(TransferToken token);
+    // Nothing recorded and every submitted batch complete, as of the last update (or any other call that polls)
+    bool isIdle() const;
+    // Hand finished copies over to the graphics queue and retire what's done, never blocks
+    // The acquires take values of the graphics timeline, so the owner of the graphics queue calls this
+    // (like every other call here) only when it isn't between taking a value and submitting with it
+    void update();
+
+    bool hasDedicatedQueue() const;
+private:
+    struct Submission
+    {
+        uint64_t value;
+        uint64_t acquireValue{0};                           // on the graphics timeline
+        VkCommandBuffer transferCommands;
+        bool needsAcquire{false};                           // ownership moves to graphics
+        VkCommandBuffer acquireCommands{VK_NULL_HANDLE};    // set once the acquire has been submitted to the graphics queue
+        std::vector<VkBufferMemoryBarrier> bufferAcquires;
+        std::vector<VkImageMemoryBarrier> imageAcquires;
+    };
+
+    VkDevice m_logicalDevice;
+    const VkAllocationCallbacks* m_hostAllocator;
+    VkQueue m_transferQueue, m_gfxQueue;
+    uint32_t m_transferFamily, m_gfxFamily;
+    VkCommandPool m_transferCommandPool, m_gfxCommandPool;
+    StagingRing* m_stagingRing;
+
+    VkCommandBuffer m_recording{VK_NULL_HANDLE};
+    std::vector<VkBufferMemoryBarrier> m_bufferReleases;
+    std::vector<VkImageMemoryBarrier> m_imageReleases;
+
+    std::deque<Submission> m_inFlight;
+    std::vector<VkCommandBuffer> m_freeTransferCommands, m_freeGfxCommands;
+    Timeline m_transferTimeline;    // of the dedicated transfer queue
+    Timeline* m_gfxTimeline;        // of the graphics queue, signalled by the acquires
+    Timeline* m_copyTimeline;       // signalled by the copies, one of the two above
+    uint64_t m_submittedValue{0}, m_completedValue{0};
+
+    VkCommandPool createCommandPool(uint32_t queueFamily);
+    VkCommandBuffer getFreeCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList);
+
+    void submitAcquire(Submission& submission);
+    // Move finished work along (transfer done -> acquire, acquire done -> complete)
+    // if wait is set block until the oldest submission has made progress
+    void poll(bool wait);
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef UNIFORM_RING_H_
+#define UNIFORM_RING_H_
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+
+#include "device_allocator.h"
+#include "per_frame_buffer.h"
+
+const VkDeviceSize DEFAULT_UNIFORM_FRAME_SIZE = 256 * 1024;    // per frame in flight
+
+// Per frame and per object constants appended to the current frame's segment of a PerFrameBuffer and
+// read through VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC descriptors, so the descriptor sets are
+// written once and every draw only passes the offset of its data
+class UniformRing
+{
+public:
+    UniformRing() {}
+
+    // minAlignment is VkPhysicalDeviceLimits::minUniformBufferOffsetAlignment
+    void init(DeviceAllocator* allocator, VkDeviceSize minAlignment, uint32_t frameCount, VkDeviceSize frameSize = DEFAULT_UNIFORM_FRAME_SIZE);
+    void destroy();
+
+    // Start appending to frameIndex's segment, only once that frame's previous submission has completed
+    void beginFrame(uint32_t frameIndex);
+
+    // Copy data into the current segment and return the dynamic offset to bind it with
+    uint32_t push(const void* data, VkDeviceSize size);
+    template<typename T>
+    uint32_t push(const T& value)
+    {
+        return push(&value, sizeof(T));
+    }
+
+    VkBuffer getBuffer() const;
+private:
+    PerFrameBuffer m_buffer;
+
+    VkDeviceSize m_alignment;
+    VkDeviceSize m_frameSize;
+    VkDeviceSize m_frameStart{0}, m_cursor{0};   // of the current segment, from the start of the buffer
+    char* m_mapped{nullptr};                     // start of the buffer
+};
+
+#endif
@@ -10,8 +10,6 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
-const int MAX_FRAME_DRAWS = 2;  // allow at most 2 images on the queue at once
-
 const std::vector<const char*> DEVICE_EXTENSIONS =
 {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -22,11 +20,18 @@ struct QueueFamilyIndices
 {
     int graphicsFamily{-1};
     int presentationFamily{-1};
+    int transferFamily{-1};     // transfer-only family if the device has one (optional)
 
     bool isValid()
     {
         return graphicsFamily >= 0 && presentationFamily >= 0;
     }
+
+    // Family uploads should go to, a dedicated (DMA) one if we found one else the graphics family
+    int getTransferFamily()
+    {
+        return transferFamily >= 0 ? transferFamily : graphicsFamily;
+    }
 };
 
 struct SwapchainDetails
@@ -66,108 +71,42 @@ struct Vertex
     glm::vec3 color;
 };
 
-static uint32_t findMemoryTypeIndex(VkPhysicalDevice physical, uint32_t allowedTypes, VkMemoryPropertyFlags flags)
+// How vertex_pull.vert decodes the vertices of a draw, the position always comes first
+enum VertexLayout : uint32_t
 {
-    VkPhysicalDeviceMemoryProperties physicalMemoryProps;
-    vkGetPhysicalDeviceMemoryProperties(physical, &physicalMemoryProps);
-
-    for (uint32_t i = 0; i < physicalMemoryProps.memoryTypeCount; i++)
-    {
-        if ((allowedTypes & (1ul << i)) && (physicalMemoryProps.memoryTypes[i].propertyFlags & flags) == flags)
-        {
-            return i;
-        }
-    }
-    return -1;
-}
-
-static void createBuffer(
-    VkPhysicalDevice physical,
-    VkDevice logical,
-    VkDeviceSize bufferSize,
-    VkBufferUsageFlags usageFlags,
-    VkMemoryPropertyFlags bufferProperties,
-    VkBuffer* buffer,
-    VkDeviceMemory* memory
-) {
-    VkBufferCreateInfo bufferInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = bufferSize,
-        .usage = usageFlags,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
-    if (vkCreateBuffer(logical, &bufferInfo, nullptr, buffer) != VK_SUCCESS)
-    {
-        throw std::runtime_error("Failed to create VkBuffer");
-    }
-
-    VkMemoryRequirements memoryReqs;
-    vkGetBufferMemoryRequirements(logical, *buffer, &memoryReqs);
-
-    VkMemoryAllocateInfo memoryAllocateInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memoryReqs.size,
-        .memoryTypeIndex = findMemoryTypeIndex(physical, memoryReqs.memoryTypeBits, bufferProperties)
-    };
-
-    if (vkAllocateMemory(logical, &memoryAllocateInfo, nullptr, memory) != VK_SUCCESS)
-    {
-        throw std::runtime_error("Failed to allocate Vertex Buffer memory");
-    }
-
-    vkBindBufferMemory(logical, *buffer, *memory, 0);
-}
-
-static void copyBuffer(
-    VkDevice device,
-    VkQueue transferQueue,
-    VkCommandPool transferCmdPool,
-    VkBuffer srcBuffer,
-    VkBuffer dstBuffer,
-    VkDeviceSize bufferSize
-) {
-    VkCommandBuffer transferCmdBuffer;
-
-    VkCommandBufferAllocateInfo allocInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandPool = transferCmdPool,
-        .commandBufferCount = 1
-    };
-
-    vkAllocateCommandBuffers(device, &allocInfo, &transferCmdBuffer);
-
-    VkCommandBufferBeginInfo beginInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-    };
-    vkBeginCommandBuffer(transferCmdBuffer, &beginInfo);
+    VERTEX_LAYOUT_POSITION_COLOR = 0,   // Vertex
+    VERTEX_LAYOUT_POSITION = 1          // xyz only, drawn white
+};
 
-    VkBufferCopy bufferCopy =
-    {
-        .size = bufferSize,
-        .srcOffset = 0,
-        .dstOffset = 0,
-    };
+// Per instance vertex data (second vertex binding, one step per instance)
+struct InstanceData
+{
+    glm::mat4 transform;
+    glm::vec4 color;    // multiplied with the vertex color
+    uint32_t draw;      // which DrawData the instance is drawn with, set when instances are packed
+};
 
-    vkCmdCopyBuffer(transferCmdBuffer, srcBuffer, dstBuffer, 1, &bufferCopy);
+// Push constants of the graphics pipeline, written before every draw
+struct DrawConstants
+{
+    glm::mat4 model;
+};
 
-    vkEndCommandBuffer(transferCmdBuffer);
+// Per draw data read by the vertex shader through InstanceData::draw (set 0 binding 1), so indirect
+// draws get something per draw without push constants
+struct DrawData
+{
+    glm::mat4 model;            // only used by indirect draws, identity when the model is pushed
+    // Where and how vertex_pull.vert reads the draw's vertices when pulling vertices
+    VkDeviceAddress vertices;   // first vertex of the mesh
+    int32_t vertexOffset;       // the draw's vertexOffset, gl_VertexIndex includes it
+    uint32_t vertexLayout;      // VertexLayout
+};
 
-    VkSubmitInfo submitInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &transferCmdBuffer
-    };
-    vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(transferQueue); // wait for trasnfer to finish (could be a problem if loading many, many meshes)
-
-    vkFreeCommandBuffers(device, transferCmdPool, 1, &transferCmdBuffer);
-}
+// Uniforms that are the same for every draw of a frame (set 0 binding 0, from the uniform ring)
+struct FrameUniforms
+{
+    glm::mat4 viewProj;
+};
 
 #endif
\ No newline at end of file
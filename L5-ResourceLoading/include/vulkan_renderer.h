@@ -5,10 +5,54 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <array>
+#include <deque>
 #include <vector>
 
 #include "utilities.h"
 #include "mesh.h"
+#include "device_allocator.h"
+#include "staging_ring.h"
+#include "transfer_context.h"
+#include "geometry_pool.h"
+#include "host_allocator.h"
+#include "worker_pool.h"
+#include "draw_list.h"
+#include "frustum_culler.h"
+#include "instance_buffer.h"
+#include "command_encoder.h"
+#include "draw_sort.h"
+#include "uniform_ring.h"
+#include "per_frame_buffer.h"
+#include "timeline.h"
+
+// Draws are only split over more recording threads when each one gets at least this many
+const uint32_t MIN_DRAWS_PER_RECORD_TASK = 256;
+
+// What presentation is tuned for, picks the present mode, swapchain image count and frames in flight together
+enum class PresentPolicy
+{
+    LowLatency,     // IMMEDIATE (or MAILBOX) with as few images as possible and one frame in flight
+    Smooth,         // FIFO_RELAXED with an extra image and two frames in flight, a late frame tears instead of waiting a refresh
+    PowerSaving     // FIFO with as few images as possible and one frame in flight, the CPU never runs ahead
+};
+
+// Choices made once at init
+struct RendererSettings
+{
+    PresentPolicy presentPolicy = PresentPolicy::Smooth;
+    // Send geometry through the staging ring even where the pool could be written directly (unified memory),
+    // run once with and once without to compare the two upload paths on the same device
+    bool stagedUploads = false;
+    // Most draws (meshes) and instances the scene can hold, buffers for them are allocated up front
+    uint32_t drawCapacity = DEFAULT_DRAW_CAPACITY;
+    uint32_t instanceCapacity = DEFAULT_INSTANCE_CAPACITY;
+    // Read vertices in the vertex shader through buffer device addresses (vertex_pull.vert) where the
+    // device supports it, every draw can then have its own vertex layout without a vertex binding
+    bool vertexPulling = false;
+    // Frames the CPU may record ahead of the GPU, 0 leaves it to the present policy
+    uint32_t framesInFlight = 0;
+};
 
 class VulkanRenderer
 {
@@ -16,15 +60,35 @@ public:
     VulkanRenderer() {}
     virtual ~VulkanRenderer() {}
 
-    int init(GLFWwindow* wnd);
+    int init(GLFWwindow* wnd, const RendererSettings& settings = RendererSettings());
     void draw();
     void destroy();
 
+    // Draw m_meshes[mesh] once more, all instances of a mesh are one draw
+    void addInstance(size_t mesh, const glm::mat4& transform, const glm::vec4& color);
+    // Move all instances of m_meshes[mesh] at once
+    void setTransform(size_t mesh, const glm::mat4& transform);
+
+    // Takes effect from the next frame, the swapchain is replaced like on a resize
+    // Frames in flight follow the policy unless they were set in the RendererSettings
+    void setPresentPolicy(PresentPolicy policy);
+    PresentPolicy getPresentPolicy() const;
+
 private:
     GLFWwindow* m_window;
 
+    // Every host allocation the driver makes for us goes through this
+    HostAllocator m_hostAllocator;
+
     VkInstance m_instance;
-    int m_currentFrame = 0;
+    // Every frame slot is allocated up front so the policy can change how many are in use at any time
+    RendererSettings m_settings;
+    PresentPolicy m_presentPolicy = PresentPolicy::Smooth;
+    uint32_t m_frameSlots = 1;          // allocated, what any policy can ask for unless the settings fix it
+    uint32_t m_framesInFlight = 1;      // in use, at most m_frameSlots
+    uint32_t m_currentFrame = 0;
+    std::vector<uint64_t> m_slotFrames;     // frame (timeline value) that last used each frame slot
+    std::deque<uint64_t> m_recentFrames;    // timeline values of the last m_framesInFlight frames, oldest first
 
     struct
     {
@@ -32,41 +96,122 @@ private:
         VkDevice logical;
     } m_device;
 
-    VkQueue m_gfxQueue, m_presentQueue;
+    // m_presentQueue is a separate queue from m_gfxQueue whenever the device has one to spare
+    VkQueue m_gfxQueue, m_presentQueue, m_transferQueue;
+
+    DeviceAllocator m_allocator;
+    StagingRing m_stagingRing;
+    TransferContext m_transfer;
+    GeometryPool m_geometry;
+
+    // The whole scene as indirect draw commands, drawn with a single call when m_indirectDraws is set
+    // (the per mesh vkCmdDrawIndexed path recorded by the workers stays for comparison)
+    DrawList m_drawList;
+    std::vector<DrawHandle> m_geometryDraws;    // geometry handle -> its draw, so moved geometry can be patched
+    bool m_indirectDraws = true;
+    bool m_multiDrawIndirect = false;
+    uint32_t m_maxDrawIndirectCount = 1;
+
+    // Indirect draws are culled on the GPU and drawn with vkCmdDrawIndexedIndirectCount where the device can
+    // and the draws fit in one call (see recordCommands)
+    FrustumCuller m_culler;
+    bool m_gpuCulling = false;
+    glm::mat4 m_viewProj{1.0f};     // no camera yet, the meshes are already in clip space
+
+    // Per instance vertex stream, re-packed whenever instances were added
+    InstanceBuffer m_instanceBuffer;
+    bool m_instancesChanged = false;
+
+    // DrawData of every mesh (same index as m_meshes), a moved mesh only rewrites its own entry
+    std::vector<DrawData> m_drawData;
+    PerFrameBuffer m_drawDataBuffer;
 
     struct
     {
         VkSurfaceKHR surface;
-        VkFormat format;
+        VkFormat format{VK_FORMAT_UNDEFINED};    // the render pass and pipelines are built for it
         VkExtent2D extent;
     } m_surface;
 
     VkSwapchainKHR m_swapchain;
     std::vector<SwapchainImage> m_swapchainImages;
+    // Frame (timeline value) that last rendered to each swapchain image, acquire can hand back an image
+    // an older frame slot is still drawing to so a frame waits on it too and not only on its own slot
+    std::vector<uint64_t> m_imageFrames;
+    bool m_swapchainOutdated = false;   // resized, out of date or suboptimal, replaced at the start of the next frame
+
+    // A replaced swapchain and everything created for its images, destroyed once frame has completed
+    struct RetiredSwapchain
+    {
+        VkSwapchainKHR swapchain;
+        std::vector<VkImageView> imageViews;
+        std::vector<VkFramebuffer> framebuffers;
+        std::vector<VkSemaphore> renderFinished;
+        uint32_t framesLeft;    // frames still to be submitted after it
+        uint64_t frame{0};      // timeline value of the last of them
+    };
+    std::deque<RetiredSwapchain> m_retiredSwapchains;
     std::vector<VkFramebuffer> m_framebuffers;
 
+    // Per frame constants come from the uniform ring, the one descriptor set points into it with a
+    // dynamic offset so it never has to be written again
+    UniformRing m_uniforms;
+    VkDescriptorSetLayout m_frameSetLayout;
+    VkDescriptorPool m_descriptorPool;
+    VkDescriptorSet m_frameSet;
+
     VkPipelineLayout m_pipelineLayout;
 
     VkRenderPass m_renderpass;
 
     VkPipeline m_gfxpipeline;
 
-    VkCommandPool m_gfxCommandPool;
-    std::vector<VkCommandBuffer> m_commandBuffers; // 1 to 1 with swapchainImages and framebuffers
+    // Vertices read by the shader through the device address in each draw's DrawData instead of a vertex
+    // binding (Vulkan 1.2 bufferDeviceAddress), same state otherwise
+    bool m_vertexPulling = false;
+    VkPipeline m_pullPipeline;
+
+    // Everything one frame in flight records into, the scene is recorded again every frame
+    // The pools are TRANSIENT and reset as a whole once the frame's timeline value has been reached
+    struct FrameCommands
+    {
+        VkCommandPool pool;
+        VkCommandBuffer primary, defrag;
+        VkDescriptorBufferInfo instances;   // the instance buffer prepared for this frame
+        bool culled;            // indirect draws of this frame go through the culler
+        // Dynamic offsets of this frame's FrameUniforms in the uniform ring and of its DrawData
+        std::array<uint32_t, 2> dynamicOffsets;
+        // Draws are recorded into secondary command buffers by the workers, one slice of m_meshes each
+        // Every slice has its own pool so no two threads ever record from the same pool
+        std::vector<VkCommandPool> slicePools;
+        std::vector<VkCommandBuffer> secondaries;
+        std::vector<CommandEncoder> encoders;  // one per secondary, drops redundant binds
+    };
+    std::vector<FrameCommands> m_frameCommands;    // one per frame in flight
+    WorkerPool m_workers;
 
-    std::vector<VkSemaphore> m_imageAvailable, m_renderFinished;
-    std::vector<VkFence> m_drawFences;
+    // Every graphics queue submission signals the next value of its timeline, frames and the transfer
+    // context's acquires alike. A frame slot is free again (and anything retired by its frame can be
+    // reused) once the timeline reaches the value its frame signalled
+    // Acquire and present only take binary semaphores: one per frame slot for acquire, one per swapchain
+    // image for present since its wait is only known to be done once the image comes back
+    Timeline m_frameTimeline;
+    std::vector<VkSemaphore> m_imageAvailable;      // per frame in flight
+    std::vector<VkSemaphore> m_renderFinished;      // per swapchain image
 
     std::vector<Mesh> m_meshes;
+    // Order the meshes are drawn in this frame (direct path), indices into m_meshes sorted by key
+    std::vector<SortedDraw> m_drawOrder, m_sortScratch;
 
     void createInstance();
     bool checkInstanceExtensionSupport(const std::vector<const char*>& tocheck) const;
 
     void createSurface();
+    static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
 
     void getPhysicalDevice();
     bool checkPhysicalDevice(const VkPhysicalDevice& device);
-    bool checkDeviceExtensionSupport(const VkPhysicalDevice& dev);
+    bool checkDeviceExtensionSupport(const VkPhysicalDevice& dev, const std::vector<const char*>& extensions = DEVICE_EXTENSIONS);
 
     QueueFamilyIndices getQueueFamilies(const VkPhysicalDevice& dev);
 
@@ -75,21 +220,60 @@ private:
     SwapchainDetails getSwapchainDetails(const VkPhysicalDevice& dev);
     VkSurfaceFormatKHR getBestSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats);
     VkPresentModeKHR getBestPresentMode(const std::vector<VkPresentModeKHR>& modes);
+    uint32_t getSwapchainImageCount(const VkSurfaceCapabilitiesKHR& capabilities, VkPresentModeKHR mode);
     VkExtent2D getBestSwapchainExtent(const VkSurfaceCapabilitiesKHR& capabilities);
     VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
-    void createSwapChain();
+    void createSwapChain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
+    // New swapchain, image views and framebuffers for the current window size, the old ones are retired
+    void recreateSwapChain();
+    void releaseRetiredSwapchains();
+    void destroyRetiredSwapchain(RetiredSwapchain& retired);
 
     VkShaderModule createShaderModule(const std::vector<char>& code);
     void createRenderPass();
+    void createDescriptorSetLayout();
+    void createDescriptorSet();
     void createGraphicsPipeline();
+    void destroyGraphicsPipeline();     // and the render pass and layout created with it
 
     void createFramebuffers();
 
     void createCommandPool();
     void allocateCommandBuffers();
-    void recordCommands();
+    void recordCommands(FrameCommands& frame, uint32_t image);
+    // Records m_drawOrder[firstDraw, endDraw)
+    void recordDrawSlice(FrameCommands& frame, uint32_t image, uint32_t slice, size_t firstDraw, size_t endDraw);
+    void sortMeshDraws();
+    // Vertex buffer (unless vertices are pulled) and instance buffer
+    void bindVertexStreams(CommandEncoder& encoder, FrameCommands& frame, VkBuffer vertexBuffer);
+    void recordIndirectDraws(FrameCommands& frame, uint32_t image);
+    // Begin secondaries[slice] inside the render pass with the pipeline bound, returns its encoder
+    CommandEncoder& beginDrawSecondary(FrameCommands& frame, uint32_t image, uint32_t slice);
+    // Move some geometry pool data if it's fragmented, returns true if defragCommands has to be submitted
+    bool recordDefragment(VkCommandBuffer defragCommands);
+
+    // Keep the draw list in step with m_meshes and with where their geometry lives
+    void addMeshDraw(Mesh& mesh);
+    void removeMeshDraw(Mesh& mesh);
+    void updateMovedDraws();
+    // Write m_meshes[mesh]'s DrawData, every frame slot picks it up the next time it's used
+    void writeDrawData(size_t mesh);
+    // Give every mesh its range of the instance buffer and update the draws to match
+    void packInstances();
 
     void createSynchronization();
+    void createPresentSemaphores();     // renderFinished, one per swapchain image
+
+    // Print which upload path the geometry went through and what it cost
+    void printUploadStats(double totalMilliseconds);
+    // Print where the driver's host memory went, per allocation scope
+    void printHostAllocationStats();
+    // Print how much of the geometry pool each mesh takes up
+    void printMeshMemory();
+    // Print device memory use per heap and owner, and every buffer/image still alive
+    void printMemoryReport();
+    // Print how many state changes the command encoders issued and how many they dropped
+    void printEncoderStats();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads started once and kept around, run() hands them a batch of tasks
+// and blocks until every task has finished (so spawning threads never shows up in a frame)
+class WorkerPool
+{
+public:
+    WorkerPool() {}
+
+    // 0 means one thread per hardware thread
+    void init(uint32_t threadCount = 0);
+    void destroy();
+
+    uint32_t getThreadCount() const;
+
+    // Calls task(i) for i in [0, count) on the workers, the first exception thrown by a task is
+    // rethrown here once all of them are done
+    void run(uint32_t count, const std::function<void(uint32_t)>& task);
+private:
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+    const std::function<void(uint32_t)>* m_task{nullptr};
+    uint32_t m_count{0}, m_next{0}, m_finished{0};
+    std::exception_ptr m_error;
+    bool m_stop{false};
+
+    void workerLoop();
+};
+
+#endif
@@ -3,9 +3,39 @@
 layout(location = 0) in vec3 vertexPos;
 layout(location = 1) in vec3 color;
 
+// Per instance (a mat4 takes up four locations, one per column)
+layout(location = 2) in mat4 instanceTransform;
+layout(location = 6) in vec4 instanceColor;
+layout(location = 7) in uint instanceDraw;
+
 layout(location = 0) out vec3 fragColor;
 
+// Per frame, FrameUniforms
+layout(set = 0, binding = 0) uniform Frame
+{
+    mat4 viewProj;
+} frame;
+
+// Per draw, DrawData of every mesh
+struct DrawData
+{
+    mat4 model;
+    uvec2 vertices;     // only read by vertex_pull.vert
+    int vertexOffset;
+    uint vertexLayout;
+};
+layout(std430, set = 0, binding = 1) readonly buffer Draws
+{
+    DrawData data[];
+} draws;
+
+// Per draw, DrawConstants
+layout(push_constant) uniform Draw
+{
+    mat4 model;
+} draw;
+
 void main() {
-    gl_Position = vec4(vertexPos, 1.0);
-    fragColor = color;
+    gl_Position = frame.viewProj * draw.model * draws.data[instanceDraw].model * instanceTransform * vec4(vertexPos, 1.0);
+    fragColor = color * instanceColor.rgb;
 }
\ No newline at end of file
@@ -0,0 +1,62 @@
+#version 450        // GLSL version 4.5
+#extension GL_EXT_buffer_reference : require
+
+// Same as vertex.vert but without a vertex binding, every draw reads its own vertices through the device
+// address in its DrawData and decodes them by its layout, so meshes with different layouts share the pipeline
+
+// Vertices as tightly packed floats, vec3 arrays would be padded to 16 bytes
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Vertices
+{
+    float values[];
+};
+
+// VertexLayout
+const uint VERTEX_LAYOUT_POSITION_COLOR = 0;    // position xyz, color rgb
+const uint VERTEX_LAYOUT_POSITION = 1;          // position xyz
+
+// Per instance (a mat4 takes up four locations, one per column)
+layout(location = 2) in mat4 instanceTransform;
+layout(location = 6) in vec4 instanceColor;
+layout(location = 7) in uint instanceDraw;
+
+layout(location = 0) out vec3 fragColor;
+
+// Per frame, FrameUniforms
+layout(set = 0, binding = 0) uniform Frame
+{
+    mat4 viewProj;
+} frame;
+
+// Per draw, DrawData of every mesh
+struct DrawData
+{
+    mat4 model;
+    Vertices vertices;
+    int vertexOffset;
+    uint vertexLayout;
+};
+layout(std430, set = 0, binding = 1) readonly buffer Draws
+{
+    DrawData data[];
+} draws;
+
+// Per draw, DrawConstants
+layout(push_constant) uniform Draw
+{
+    mat4 model;
+} draw;
+
+void main() {
+    DrawData drawData = draws.data[instanceDraw];
+
+    // gl_VertexIndex is the index plus the draw's vertexOffset, the draw's vertices start at its own address
+    bool hasColor = drawData.vertexLayout == VERTEX_LAYOUT_POSITION_COLOR;
+    uint first = uint(gl_VertexIndex - drawData.vertexOffset) * (hasColor ? 6u : 3u);
+    vec3 vertexPos = vec3(drawData.vertices.values[first], drawData.vertices.values[first + 1], drawData.vertices.values[first + 2]);
+    vec3 color = hasColor
+        ? vec3(drawData.vertices.values[first + 3], drawData.vertices.values[first + 4], drawData.vertices.values[first + 5])
+        : vec3(1.0);
+
+    gl_Position = frame.viewProj * draw.model * drawData.model * instanceTransform * vec4(vertexPos, 1.0);
+    fragColor = color * instanceColor.rgb;
+}
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include "command_encoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+EncoderStats& EncoderStats::operator+=(const EncoderStats& other)
+{
+    for (size_t i = 0; i < issued.size(); i++)
+    {
+        issued[i] += other.issued[i];
+        elided[i] += other.elided[i];
+    }
+    return *this;
+}
+
+void CommandEncoder::begin(VkCommandBuffer cmd)
+{
+    m_cmd = cmd;
+    m_bindPoints = {};
+    m_vertexBindings = {};
+    m_indexBuffer = VK_NULL_HANDLE;
+    m_indexOffset = 0;
+    m_indexType = VK_INDEX_TYPE_UINT32;
+    m_pushLayout = VK_NULL_HANDLE;
+    m_pushStages = {};
+}
+
+VkCommandBuffer CommandEncoder::getCommandBuffer() const
+{
+    return m_cmd;
+}
+
+void CommandEncoder::bindPipeline(VkPipelineBindPoint bindPoint, VkPipeline pipeline)
+{
+    BindPointState* state = getBindPoint(bindPoint);
+    bool redundant = state != nullptr && state->pipeline == pipeline;
+    if (!count(EncoderCall::Pipeline, redundant)) return;
+
+    vkCmdBindPipeline(m_cmd, bindPoint, pipeline);
+    if (state != nullptr) state->pipeline = pipeline;
+}
+
+void CommandEncoder::bindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* buffers, const VkDeviceSize* offsets)
+{
+    bool tracked = firstBinding + bindingCount <= MAX_TRACKED_VERTEX_BINDINGS;
+    bool redundant = tracked;
+    for (uint32_t i = 0; redundant && i < bindingCount; i++)
+    {
+        const VertexBinding& bound = m_vertexBindings[firstBinding + i];
+        redundant = bound.buffer == buffers[i] && bound.offset == offsets[i];
+    }
+    if (!count(EncoderCall::VertexBuffers, redundant)) return;
+
+    vkCmdBindVertexBuffers(m_cmd, firstBinding, bindingCount, buffers, offsets);
+    for (uint32_t i = 0; tracked && i < bindingCount; i++)
+    {
+        m_vertexBindings[firstBinding + i] = { buffers[i], offsets[i] };
+    }
+}
+
+void CommandEncoder::bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType)
+{
+    bool redundant = m_indexBuffer == buffer && m_indexOffset == offset && m_indexType == indexType;
+    if (!count(EncoderCall::IndexBuffer, redundant)) return;
+
+    vkCmdBindIndexBuffer(m_cmd, buffer, offset, indexType);
+    m_indexBuffer = buffer;
+    m_indexOffset = offset;
+    m_indexType = indexType;
+}
+
+void CommandEncoder::bindDescriptorSets(
+    VkPipelineBindPoint bindPoint,
+    VkPipelineLayout layout,
+    uint32_t firstSet,
+    uint32_t setCount,
+    const VkDescriptorSet* sets,
+    uint32_t dynamicOffsetCount,
+    const uint32_t* dynamicOffsets)
+{
+    BindPointState* state = getBindPoint(bindPoint);
+    bool tracked = state != nullptr && firstSet + setCount <= MAX_TRACKED_DESCRIPTOR_SETS;
+
+    // Only the same sets bound together with the same dynamic offsets through the same layout are a no-op
+    bool redundant = tracked && state->setLayout == layout;
+    for (uint32_t i = 0; redundant && i < setCount; i++)
+    {
+        const DescriptorSetBinding& bound = state->sets[firstSet + i];
+        redundant = bound.set == sets[i] && bound.firstOfCall == firstSet;
+    }
+    if (redundant)
+    {
+        const std::vector<uint32_t>& bound = state->sets[firstSet].dynamicOffsets;
+        redundant = bound.size() == dynamicOffsetCount && std::equal(bound.begin(), bound.end(), dynamicOffsets);
+    }
+    if (!count(EncoderCall::DescriptorSets, redundant)) return;
+
+    vkCmdBindDescriptorSets(m_cmd, bindPoint, layout, firstSet, setCount, sets, dynamicOffsetCount, dynamicOffsets);
+    if (state == nullptr) return;
+
+    // Binding with a different layout may disturb every other set, so stop trusting them
+    if (state->setLayout != layout)
+    {
+        state->sets = {};
+        state->setLayout = layout;
+    }
+    for (uint32_t i = 0; tracked && i < setCount; i++)
+    {
+        state->sets[firstSet + i] = { sets[i], firstSet, {} };
+    }
+    if (tracked && setCount > 0)
+    {
+        state->sets[firstSet].dynamicOffsets.assign(dynamicOffsets, dynamicOffsets + dynamicOffsetCount);
+    }
+}
+
+void CommandEncoder::pushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset, uint32_t size, const void* values)
+{
+    bool tracked = offset + size <= MAX_TRACKED_PUSH_CONSTANT_BYTES;
+    if (tracked && layout != m_pushLayout)
+    {
+        // Pushed values are only kept across layouts with identical push constant ranges, don't guess
+        m_pushLayout = layout;
+        m_pushStages = {};
+    }
+
+    bool redundant = tracked && memcmp(&m_pushValues[offset], values, size) == 0;
+    for (uint32_t i = offset; redundant && i < offset + size; i++)
+    {
+        redundant = m_pushStages[i] == stages;
+    }
+    if (!count(EncoderCall::PushConstants, redundant)) return;
+
+    vkCmdPushConstants(m_cmd, layout, stages, offset, size, values);
+    if (tracked)
+    {
+        memcpy(&m_pushValues[offset], values, size);
+        std::fill(m_pushStages.begin() + offset, m_pushStages.begin() + offset + size, stages);
+    }
+}
+
+void CommandEncoder::drawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
+{
+    vkCmdDrawIndexed(m_cmd, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+}
+
+void CommandEncoder::drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+{
+    vkCmdDrawIndexedIndirect(m_cmd, buffer, offset, drawCount, stride);
+}
+
+void CommandEncoder::drawIndexedIndirectCount(VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride)
+{
+    vkCmdDrawIndexedIndirectCount(m_cmd, buffer, offset, countBuffer, countOffset, maxDrawCount, stride);
+}
+
+const EncoderStats& CommandEncoder::getStats() const
+{
+    return m_stats;
+}
+
+CommandEncoder::BindPointState* CommandEncoder::getBindPoint(VkPipelineBindPoint bindPoint)
+{
+    // Anything else (e.g. ray tracing) is passed through untracked
+    if (bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS) return &m_bindPoints[0];
+    if (bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) return &m_bindPoints[1];
+    return nullptr;
+}
+
+bool CommandEncoder::count(EncoderCall call, bool redundant)
+{
+    if (redundant)
+    {
+        m_stats.elided[size_t(call)]++;
+        return false;
+    }
+    m_stats.issued[size_t(call)]++;
+    return true;
+}
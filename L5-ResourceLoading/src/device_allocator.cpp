@@ -0,0 +1,305 @@
+#include "device_allocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void DeviceAllocator::init(
+    VkPhysicalDevice physical,
+    VkDevice logical,
+    const VkAllocationCallbacks* hostAllocator,
+    bool budgetExtension,
+    bool deviceAddress,
+    VkDeviceSize blockSize
+) {
+    m_physicalDevice = physical;
+    m_logicalDevice = logical;
+    m_hostAllocator = hostAllocator;
+    m_blockSize = blockSize;
+    m_deviceAddress = deviceAddress;
+
+    m_memoryTypes.init(m_physicalDevice, budgetExtension);
+
+    // Buffers and optimal images placed closer than this may alias on some hardware
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &props);
+    m_granularity = props.limits.bufferImageGranularity;
+}
+
+void DeviceAllocator::destroy()
+{
+    for (uint32_t type = 0; type < m_blocks.size(); type++)
+    {
+        for (auto& block : m_blocks[type])
+        {
+            if (block.memory != VK_NULL_HANDLE)
+            {
+                freeDeviceMemory(block.memory, block.ranges.getSize(), type);
+            }
+        }
+        m_blocks[type].clear();
+    }
+}
+
+Allocation DeviceAllocator::allocate(const VkMemoryRequirements& reqs, const MemoryPreferences& preferences, ResourceKind kind)
+{
+    Allocation allocation;
+
+    // Only ask the driver for fresh heap numbers if we actually need new device memory
+    bool budgetRefreshed = false;
+    auto hasBudget = [&](uint32_t memoryType, VkDeviceSize size) {
+        if (!budgetRefreshed)
+        {
+            m_memoryTypes.refreshBudget();
+            budgetRefreshed = true;
+        }
+        return m_memoryTypes.hasBudget(memoryType, size);
+    };
+
+    for (auto flags : preferences)
+    {
+        for (uint32_t memoryType : m_memoryTypes.getCandidates(reqs.memoryTypeBits, flags))
+        {
+            VkDeviceSize blockSize = getBlockSize(memoryType);
+
+            // Big resources would waste most of a block so give them their own memory
+            if (reqs.size > blockSize / 2)
+            {
+                if (!hasBudget(memoryType, reqs.size)) continue;
+
+                // The budget is only the heap size without VK_EXT_memory_budget, the driver can still say no
+                allocation.memory = allocateDeviceMemory(reqs.size, memoryType, &allocation.mapped);
+                if (allocation.memory == VK_NULL_HANDLE) continue;
+                allocation.size = reqs.size;
+                allocation.memoryType = memoryType;
+                allocation.block = DEDICATED_BLOCK;
+                return allocation;
+            }
+
+            if (allocateFromBlocks(memoryType, reqs, kind, &allocation)) return allocation;
+
+            if (!hasBudget(memoryType, blockSize)) continue;
+
+            if (!createBlock(memoryType)) continue;
+            if (allocateFromBlocks(memoryType, reqs, kind, &allocation)) return allocation;
+        }
+    }
+
+    throw std::runtime_error("No memory type with the requested properties could fit the allocation");
+}
+
+void DeviceAllocator::free(Allocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE) return;
+
+    if (allocation.block == DEDICATED_BLOCK)
+    {
+        freeDeviceMemory(allocation.memory, allocation.size, allocation.memoryType);
+    }
+    else
+    {
+        auto& blocks = m_blocks[allocation.memoryType];
+        MemoryBlock& block = blocks[allocation.block];
+        block.ranges.free(allocation.offset);
+
+        // Hand empty blocks back to the driver but keep one around so we don't thrash on alloc/free
+        if (block.ranges.isEmpty())
+        {
+            size_t liveBlocks = std::count_if(
+                blocks.begin(),
+                blocks.end(),
+                [](const MemoryBlock& b) { return b.memory != VK_NULL_HANDLE; }
+            );
+            if (liveBlocks > 1)
+            {
+                freeDeviceMemory(block.memory, block.ranges.getSize(), allocation.memoryType);
+                block = MemoryBlock();
+            }
+        }
+    }
+
+    allocation = Allocation();
+}
+
+void DeviceAllocator::createBuffer(
+    VkDeviceSize bufferSize,
+    VkBufferUsageFlags usageFlags,
+    const MemoryPreferences& bufferProperties,
+    VkBuffer* buffer,
+    Allocation* allocation,
+    const char* owner
+) {
+    VkBufferCreateInfo bufferInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = bufferSize,
+        .usage = usageFlags,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    if (vkCreateBuffer(m_logicalDevice, &bufferInfo, m_hostAllocator, buffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create VkBuffer");
+    }
+
+    VkMemoryRequirements memoryReqs;
+    vkGetBufferMemoryRequirements(m_logicalDevice, *buffer, &memoryReqs);
+
+    *allocation = allocate(memoryReqs, bufferProperties, ResourceKind::Linear);
+
+    vkBindBufferMemory(m_logicalDevice, *buffer, allocation->memory, allocation->offset);
+
+    uint32_t heap = m_memoryTypes.getProperties().memoryTypes[allocation->memoryType].heapIndex;
+    m_tracker.track(TrackedType::Buffer, (uint64_t)*buffer, owner, allocation->size, allocation->memoryType, heap);
+}
+
+void DeviceAllocator::destroyBuffer(VkBuffer buffer, Allocation& allocation)
+{
+    m_tracker.untrack(TrackedType::Buffer, (uint64_t)buffer);
+    vkDestroyBuffer(m_logicalDevice, buffer, m_hostAllocator);
+    free(allocation);
+}
+
+void DeviceAllocator::createImage(
+    const VkImageCreateInfo& imageInfo,
+    const MemoryPreferences& imageProperties,
+    VkImage* image,
+    Allocation* allocation,
+    const char* owner
+) {
+    if (vkCreateImage(m_logicalDevice, &imageInfo, m_hostAllocator, image) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create VkImage");
+    }
+
+    VkMemoryRequirements memoryReqs;
+    vkGetImageMemoryRequirements(m_logicalDevice, *image, &memoryReqs);
+
+    ResourceKind kind = imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceKind::Optimal : ResourceKind::Linear;
+    *allocation = allocate(memoryReqs, imageProperties, kind);
+
+    vkBindImageMemory(m_logicalDevice, *image, allocation->memory, allocation->offset);
+
+    uint32_t heap = m_memoryTypes.getProperties().memoryTypes[allocation->memoryType].heapIndex;
+    m_tracker.track(TrackedType::Image, (uint64_t)*image, owner, allocation->size, allocation->memoryType, heap);
+}
+
+void DeviceAllocator::destroyImage(VkImage image, Allocation& allocation)
+{
+    m_tracker.untrack(TrackedType::Image, (uint64_t)image);
+    vkDestroyImage(m_logicalDevice, image, m_hostAllocator);
+    free(allocation);
+}
+
+const MemoryTypeSelector& DeviceAllocator::getMemoryTypes() const
+{
+    return m_memoryTypes;
+}
+
+const MemoryTracker& DeviceAllocator::getTracker() const
+{
+    return m_tracker;
+}
+
+bool DeviceAllocator::hasDeviceAddress() const
+{
+    return m_deviceAddress;
+}
+
+VkDeviceAddress DeviceAllocator::getBufferAddress(VkBuffer buffer) const
+{
+    VkBufferDeviceAddressInfo addressInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = buffer
+    };
+    return vkGetBufferDeviceAddress(m_logicalDevice, &addressInfo);
+}
+
+bool DeviceAllocator::allocateFromBlocks(uint32_t memoryType, const VkMemoryRequirements& reqs, ResourceKind kind, Allocation* allocation)
+{
+    auto& blocks = m_blocks[memoryType];
+    for (uint32_t i = 0; i < blocks.size(); i++)
+    {
+        MemoryBlock& block = blocks[i];
+        if (block.memory != VK_NULL_HANDLE && block.ranges.allocate(reqs.size, reqs.alignment, kind, &allocation->offset))
+        {
+            allocation->memory = block.memory;
+            allocation->size = reqs.size;
+            allocation->mapped = block.mapped != nullptr ? static_cast<char*>(block.mapped) + allocation->offset : nullptr;
+            allocation->memoryType = memoryType;
+            allocation->block = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+VkDeviceMemory DeviceAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped)
+{
+    // Any buffer may end up in any block, so either all memory can hold buffers with addresses or none
+    VkMemoryAllocateFlagsInfo flagsInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT
+    };
+    VkMemoryAllocateInfo memoryAllocateInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = m_deviceAddress ? &flagsInfo : nullptr,
+        .allocationSize = size,
+        .memoryTypeIndex = memoryType
+    };
+
+    // Out of memory in this type isn't fatal, the caller moves on to the next candidate
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(m_logicalDevice, &memoryAllocateInfo, m_hostAllocator, &memory) != VK_SUCCESS)
+    {
+        return VK_NULL_HANDLE;
+    }
+    m_memoryTypes.trackAllocation(memoryType, size);
+
+    // Host visible memory stays mapped for its whole life, mapping is not free and we're allowed to keep it
+    *mapped = nullptr;
+    if (m_memoryTypes.getFlags(memoryType) & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        vkMapMemory(m_logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, mapped);
+    }
+
+    return memory;
+}
+
+void DeviceAllocator::freeDeviceMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType)
+{
+    vkFreeMemory(m_logicalDevice, memory, m_hostAllocator); // also unmaps the memory
+    m_memoryTypes.trackFree(memoryType, size);
+}
+
+VkDeviceSize DeviceAllocator::getBlockSize(uint32_t memoryType)
+{
+    // Don't let a single block take a big bite out of a small heap
+    const VkPhysicalDeviceMemoryProperties& props = m_memoryTypes.getProperties();
+    uint32_t heapIndex = props.memoryTypes[memoryType].heapIndex;
+    return std::min(m_blockSize, props.memoryHeaps[heapIndex].size / 8);
+}
+
+bool DeviceAllocator::createBlock(uint32_t memoryType)
+{
+    VkDeviceSize blockSize = getBlockSize(memoryType);
+
+    MemoryBlock block;
+    block.memory = allocateDeviceMemory(blockSize, memoryType, &block.mapped);
+    if (block.memory == VK_NULL_HANDLE) return false;
+    block.ranges = RangeAllocator(blockSize, m_granularity);
+
+    // Reuse a released slot so the block indices held by live allocations stay valid
+    auto& blocks = m_blocks[memoryType];
+    for (uint32_t i = 0; i < blocks.size(); i++)
+    {
+        if (blocks[i].memory == VK_NULL_HANDLE)
+        {
+            blocks[i] = block;
+            return true;
+        }
+    }
+    blocks.push_back(block);
+    return true;
+}
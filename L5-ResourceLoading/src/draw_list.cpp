@@ -0,0 +1,132 @@
+#include "draw_list.h"
+
+#include <stdexcept>
+
+void DrawList::init(DeviceAllocator* allocator, uint32_t frameCount, uint32_t capacity)
+{
+    m_capacity = capacity;
+
+    // STORAGE so a compute pass can read them too (e.g. to cull)
+    m_commandBuffer.init(
+        allocator,
+        frameCount,
+        VkDeviceSize(capacity) * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        "draw list"
+    );
+    m_boundsBuffer.init(
+        allocator,
+        frameCount,
+        VkDeviceSize(capacity) * sizeof(glm::vec4),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        "draw list bounds"
+    );
+}
+
+void DrawList::destroy()
+{
+    m_commandBuffer.destroy();
+    m_boundsBuffer.destroy();
+}
+
+DrawHandle DrawList::add(const VkDrawIndexedIndirectCommand& command, const glm::vec4& bounds)
+{
+    if (m_commands.size() == m_capacity)
+    {
+        throw std::runtime_error("Draw list is full");
+    }
+
+    DrawHandle handle;
+    if (!m_freeHandles.empty())
+    {
+        handle = m_freeHandles.back();
+        m_freeHandles.pop_back();
+    }
+    else
+    {
+        handle = static_cast<DrawHandle>(m_slotOfHandle.size());
+        m_slotOfHandle.push_back(0);
+    }
+
+    uint32_t slot = static_cast<uint32_t>(m_commands.size());
+    m_commands.push_back(command);
+    m_bounds.push_back(bounds);
+    m_handleOfSlot.push_back(handle);
+    m_slotOfHandle[handle] = slot;
+    markDirty(slot);
+
+    return handle;
+}
+
+void DrawList::update(DrawHandle handle, const VkDrawIndexedIndirectCommand& command)
+{
+    uint32_t slot = m_slotOfHandle[handle];
+    m_commands[slot] = command;
+    markDirty(slot);
+}
+
+void DrawList::setBounds(DrawHandle handle, const glm::vec4& bounds)
+{
+    uint32_t slot = m_slotOfHandle[handle];
+    m_bounds[slot] = bounds;
+    markDirty(slot);
+}
+
+const VkDrawIndexedIndirectCommand& DrawList::get(DrawHandle handle) const
+{
+    return m_commands[m_slotOfHandle[handle]];
+}
+
+void DrawList::remove(DrawHandle handle)
+{
+    // Keep the commands packed by moving the last one into the hole
+    uint32_t slot = m_slotOfHandle[handle];
+    uint32_t last = static_cast<uint32_t>(m_commands.size() - 1);
+    if (slot != last)
+    {
+        m_commands[slot] = m_commands[last];
+        m_bounds[slot] = m_bounds[last];
+        m_handleOfSlot[slot] = m_handleOfSlot[last];
+        m_slotOfHandle[m_handleOfSlot[slot]] = slot;
+        markDirty(slot);
+    }
+    m_commands.pop_back();
+    m_bounds.pop_back();
+    m_handleOfSlot.pop_back();
+    m_freeHandles.push_back(handle);
+}
+
+uint32_t DrawList::getCount() const
+{
+    return static_cast<uint32_t>(m_commands.size());
+}
+
+uint32_t DrawList::getCapacity() const
+{
+    return m_capacity;
+}
+
+VkDescriptorBufferInfo DrawList::prepareFrame(uint32_t frameIndex)
+{
+    // Commands past the end were removed, the count stops the GPU from reading them
+    m_commandBuffer.flush(frameIndex, m_commands.data(), m_commands.size() * sizeof(VkDrawIndexedIndirectCommand));
+    m_boundsBuffer.flush(frameIndex, m_bounds.data(), m_bounds.size() * sizeof(glm::vec4));
+
+    return m_commandBuffer.getFrame(frameIndex);
+}
+
+VkDescriptorBufferInfo DrawList::getCommandBuffer(uint32_t frameIndex) const
+{
+    return m_commandBuffer.getFrame(frameIndex);
+}
+
+VkDescriptorBufferInfo DrawList::getBoundsBuffer(uint32_t frameIndex) const
+{
+    return m_boundsBuffer.getFrame(frameIndex);
+}
+
+void DrawList::markDirty(uint32_t slot)
+{
+    m_commandBuffer.markDirty(VkDeviceSize(slot) * sizeof(VkDrawIndexedIndirectCommand), sizeof(VkDrawIndexedIndirectCommand));
+    m_boundsBuffer.markDirty(VkDeviceSize(slot) * sizeof(glm::vec4), sizeof(glm::vec4));
+}
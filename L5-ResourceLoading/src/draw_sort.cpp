@@ -0,0 +1,61 @@
+#include "draw_sort.h"
+
+#include <algorithm>
+#include <array>
+
+static uint64_t field(uint32_t value, uint32_t bits)
+{
+    return uint64_t(value) & ((uint64_t(1) << bits) - 1);
+}
+
+uint64_t makeSortKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth)
+{
+    uint32_t maxDepth = (1u << SORT_KEY_DEPTH_BITS) - 1;
+    uint32_t quantizedDepth = static_cast<uint32_t>(std::clamp(depth, 0.0f, 1.0f) * maxDepth);
+
+    uint64_t key = field(pass, SORT_KEY_PASS_BITS);
+    key = (key << SORT_KEY_PIPELINE_BITS) | field(pipeline, SORT_KEY_PIPELINE_BITS);
+    key = (key << SORT_KEY_MATERIAL_BITS) | field(material, SORT_KEY_MATERIAL_BITS);
+    key = (key << SORT_KEY_MESH_BITS) | field(mesh, SORT_KEY_MESH_BITS);
+    key = (key << SORT_KEY_DEPTH_BITS) | field(quantizedDepth, SORT_KEY_DEPTH_BITS);
+    return key;
+}
+
+void sortDraws(std::vector<SortedDraw>& draws, std::vector<SortedDraw>& scratch)
+{
+    const uint32_t DIGITS = sizeof(uint64_t);
+    const uint32_t RADIX = 256;
+
+    if (draws.size() < 2) return;
+
+    std::array<std::array<uint32_t, RADIX>, DIGITS> counts{};
+    for (auto& draw : draws)
+    {
+        for (uint32_t digit = 0; digit < DIGITS; digit++)
+        {
+            counts[digit][(draw.key >> (digit * 8)) & 0xff]++;
+        }
+    }
+
+    scratch.resize(draws.size());
+    for (uint32_t digit = 0; digit < DIGITS; digit++)
+    {
+        // Every key has the same byte here, a pass wouldn't move anything
+        std::array<uint32_t, RADIX>& count = counts[digit];
+        if (count[(draws[0].key >> (digit * 8)) & 0xff] == draws.size()) continue;
+
+        std::array<uint32_t, RADIX> offsets;
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < RADIX; bucket++)
+        {
+            offsets[bucket] = offset;
+            offset += count[bucket];
+        }
+
+        for (auto& draw : draws)
+        {
+            scratch[offsets[(draw.key >> (digit * 8)) & 0xff]++] = draw;
+        }
+        draws.swap(scratch);
+    }
+}
@@ -0,0 +1,265 @@
+#include "frustum_culler.h"
+
+#include <array>
+#include <stdexcept>
+
+#include "utilities.h"
+
+void FrustumCuller::init(VkDevice device, const VkAllocationCallbacks* hostAllocator, DeviceAllocator* allocator, DrawList* drawList, uint32_t frameCount)
+{
+    m_device = device;
+    m_hostAllocator = hostAllocator;
+    m_allocator = allocator;
+    m_drawList = drawList;
+
+    createPipeline();
+    createFrameBuffers(frameCount);
+}
+
+void FrustumCuller::destroy()
+{
+    for (auto& frame : m_frames)
+    {
+        m_allocator->destroyBuffer(frame.draws, frame.drawsMemory);
+        m_allocator->destroyBuffer(frame.count, frame.countMemory);
+    }
+    m_frames.clear();
+    vkDestroyDescriptorPool(m_device, m_descriptorPool, m_hostAllocator);   // frees the sets too
+    vkDestroyPipeline(m_device, m_pipeline, m_hostAllocator);
+    vkDestroyPipelineLayout(m_device, m_pipelineLayout, m_hostAllocator);
+    vkDestroyDescriptorSetLayout(m_device, m_setLayout, m_hostAllocator);
+}
+
+void FrustumCuller::record(VkCommandBuffer cmd, uint32_t frameIndex, const glm::mat4& viewProj)
+{
+    FrameBuffers& frame = m_frames[frameIndex];
+
+    // Planes straight from the rows of the matrix (Gribb/Hartmann), with Vulkan's 0..1 depth range
+    // glm is column major so row i is m[0][i], m[1][i], m[2][i], m[3][i]
+    glm::mat4 rows = glm::transpose(viewProj);
+    PushConstants constants =
+    {
+        .planes =
+        {
+            rows[3] + rows[0],  // left
+            rows[3] - rows[0],  // right
+            rows[3] + rows[1],  // top (y points down)
+            rows[3] - rows[1],  // bottom
+            rows[2],            // near
+            rows[3] - rows[2]   // far
+        },
+        .drawCount = m_drawList->getCount()
+    };
+    for (auto& plane : constants.planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    // The survivors are counted from zero again every frame
+    vkCmdFillBuffer(cmd, frame.count, 0, sizeof(uint32_t), 0);
+    VkMemoryBarrier clearBarrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+    };
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        1, &clearBarrier,
+        0, nullptr,
+        0, nullptr
+    );
+
+    if (constants.drawCount > 0)
+    {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &frame.set, 0, nullptr);
+        vkCmdPushConstants(cmd, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
+        vkCmdDispatch(cmd, (constants.drawCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    }
+
+    // The draws read both buffers as indirect arguments
+    VkMemoryBarrier cullBarrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+    };
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        0,
+        1, &cullBarrier,
+        0, nullptr,
+        0, nullptr
+    );
+}
+
+VkBuffer FrustumCuller::getVisibleDraws(uint32_t frameIndex) const
+{
+    return m_frames[frameIndex].draws;
+}
+
+VkBuffer FrustumCuller::getVisibleCount(uint32_t frameIndex) const
+{
+    return m_frames[frameIndex].count;
+}
+
+void FrustumCuller::createPipeline()
+{
+    // Draws and bounds in, visible draws and their count out
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings;
+    for (uint32_t i = 0; i < bindings.size(); i++)
+    {
+        bindings[i] =
+        {
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+        };
+    }
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(bindings.size()),
+        .pBindings = bindings.data()
+    };
+    if (vkCreateDescriptorSetLayout(m_device, &setLayoutInfo, m_hostAllocator, &m_setLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create culling descriptor set layout");
+    }
+
+    VkPushConstantRange pushRange =
+    {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(PushConstants)
+    };
+    VkPipelineLayoutCreateInfo layoutInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &m_setLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushRange
+    };
+    if (vkCreatePipelineLayout(m_device, &layoutInfo, m_hostAllocator, &m_pipelineLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create culling pipeline layout");
+    }
+
+    auto code = readFile("shader/cull.spv");
+    VkShaderModuleCreateInfo shaderInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = code.size(),
+        .pCode = reinterpret_cast<const uint32_t*>(code.data())
+    };
+    VkShaderModule shaderModule;
+    if (vkCreateShaderModule(m_device, &shaderInfo, m_hostAllocator, &shaderModule) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create culling shader module");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage =
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = shaderModule,
+            .pName = "main"
+        },
+        .layout = m_pipelineLayout
+    };
+    VkResult result = vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, m_hostAllocator, &m_pipeline);
+    vkDestroyShaderModule(m_device, shaderModule, m_hostAllocator);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create culling pipeline");
+    }
+}
+
+void FrustumCuller::createFrameBuffers(uint32_t frameCount)
+{
+    VkDescriptorPoolSize poolSize =
+    {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 4 * frameCount
+    };
+    VkDescriptorPoolCreateInfo poolInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = frameCount,
+        .poolSizeCount = 1,
+        .pPoolSizes = &poolSize
+    };
+    if (vkCreateDescriptorPool(m_device, &poolInfo, m_hostAllocator, &m_descriptorPool) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create culling descriptor pool");
+    }
+
+    // Only ever touched by the GPU
+    m_frames.resize(frameCount);
+    for (uint32_t i = 0; i < frameCount; i++)
+    {
+        FrameBuffers& frame = m_frames[i];
+        m_allocator->createBuffer(
+            VkDeviceSize(m_drawList->getCapacity()) * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT },
+            &frame.draws,
+            &frame.drawsMemory,
+            "culled draws"
+        );
+        m_allocator->createBuffer(
+            sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT },
+            &frame.count,
+            &frame.countMemory,
+            "culled draw count"
+        );
+
+        VkDescriptorSetAllocateInfo setInfo =
+        {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = m_descriptorPool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &m_setLayout
+        };
+        if (vkAllocateDescriptorSets(m_device, &setInfo, &frame.set) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate culling descriptor set");
+        }
+
+        // The buffers never change so the sets are written once
+        std::array<VkDescriptorBufferInfo, 4> bufferInfos =
+        {{
+            m_drawList->getCommandBuffer(i),
+            m_drawList->getBoundsBuffer(i),
+            { frame.draws, 0, VK_WHOLE_SIZE },
+            { frame.count, 0, VK_WHOLE_SIZE }
+        }};
+        std::array<VkWriteDescriptorSet, 4> writes;
+        for (uint32_t b = 0; b < writes.size(); b++)
+        {
+            writes[b] =
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = frame.set,
+                .dstBinding = b,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &bufferInfos[b]
+            };
+        }
+        vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+}
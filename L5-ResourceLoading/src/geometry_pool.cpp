@@ -0,0 +1,374 @@
+#include "geometry_pool.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+void GeometryPool::init(DeviceAllocator* allocator, uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+    m_allocator = allocator;
+
+    // On unified memory the device local memory can be mapped too, so ask for that and skip staging
+    // On discrete GPUs mappable device local memory is a small BAR window, leave it for things that need it
+    MemoryPreferences memoryPrefs = { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT };
+    if (m_allocator->getMemoryTypes().hasUnifiedMemory())
+    {
+        memoryPrefs.insert(memoryPrefs.begin(), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+
+    // TRANSFER_SRC because defragmenting copies the buffers into themselves
+    // Vertices can also be pulled by the vertex shader through their address
+    VkBufferUsageFlags vertexUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    if (m_allocator->hasDeviceAddress())
+    {
+        vertexUsage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    }
+    createRegion(
+        m_vertices,
+        sizeof(Vertex),
+        vertexCapacity,
+        vertexUsage,
+        memoryPrefs,
+        "geometry pool vertices"
+    );
+    createRegion(
+        m_indices,
+        sizeof(uint32_t),
+        indexCapacity,
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        memoryPrefs,
+        "geometry pool indices"
+    );
+
+    m_directWrite = canWriteDirect();
+}
+
+void GeometryPool::destroy()
+{
+    m_allocator->destroyBuffer(m_indices.buffer, m_indices.memory);
+    m_allocator->destroyBuffer(m_vertices.buffer, m_vertices.memory);
+}
+
+GeometryHandle GeometryPool::allocate(uint32_t vertexCount, uint32_t indexCount)
+{
+    GeometryHandle handle;
+    if (!m_freeHandles.empty())
+    {
+        handle = m_freeHandles.back();
+        m_freeHandles.pop_back();
+    }
+    else
+    {
+        handle = static_cast<GeometryHandle>(m_handles.size());
+        m_handles.push_back({});
+    }
+
+    GeometryRange& range = m_handles[handle];
+    range.vertexCount = vertexCount;
+    range.indexCount = indexCount;
+
+    if (!allocateRange(m_vertices, vertexCount, handle, &range.firstVertex))
+    {
+        m_freeHandles.push_back(handle);
+        throw std::runtime_error("Geometry pool is out of vertex space");
+    }
+    if (!allocateRange(m_indices, indexCount, handle, &range.firstIndex))
+    {
+        // Nothing can be using the vertex range yet so it goes straight back
+        if (vertexCount > 0)
+        {
+            m_vertices.owners.erase(VkDeviceSize(range.firstVertex) * m_vertices.stride);
+            m_vertices.ranges.free(VkDeviceSize(range.firstVertex) * m_vertices.stride);
+        }
+        m_freeHandles.push_back(handle);
+        throw std::runtime_error("Geometry pool is out of index space");
+    }
+
+    return handle;
+}
+
+void GeometryPool::free(GeometryHandle handle)
+{
+    const GeometryRange& range = m_handles[handle];
+    retireRange(m_vertices, range.firstVertex, range.vertexCount);
+    retireRange(m_indices, range.firstIndex, range.indexCount);
+    m_freeHandles.push_back(handle);
+}
+
+const GeometryRange& GeometryPool::getRange(GeometryHandle handle) const
+{
+    return m_handles[handle];
+}
+
+VkDrawIndexedIndirectCommand GeometryPool::getDrawCommand(GeometryHandle handle) const
+{
+    const GeometryRange& range = m_handles[handle];
+    return
+    {
+        .indexCount = range.indexCount,
+        .instanceCount = 1,
+        .firstIndex = range.firstIndex,
+        .vertexOffset = static_cast<int32_t>(range.firstVertex),
+        .firstInstance = 0
+    };
+}
+
+uint32_t GeometryPool::getLiveCount() const
+{
+    return static_cast<uint32_t>(m_handles.size() - m_freeHandles.size());
+}
+
+VkDeviceSize GeometryPool::getUsedBytes() const
+{
+    return m_vertices.ranges.getUsed() + m_indices.ranges.getUsed();
+}
+
+void GeometryPool::uploadVertices(TransferContext* transfer, GeometryHandle handle, const Vertex* vertices)
+{
+    const GeometryRange& range = m_handles[handle];
+    upload(transfer, vertices, VkDeviceSize(range.vertexCount) * sizeof(Vertex), m_vertices, VkDeviceSize(range.firstVertex) * sizeof(Vertex));
+}
+
+void GeometryPool::uploadIndices(TransferContext* transfer, GeometryHandle handle, const uint32_t* indices)
+{
+    const GeometryRange& range = m_handles[handle];
+    upload(transfer, indices, VkDeviceSize(range.indexCount) * sizeof(uint32_t), m_indices, VkDeviceSize(range.firstIndex) * sizeof(uint32_t));
+}
+
+void GeometryPool::beginFrame(uint64_t frame, uint64_t completedFrame)
+{
+    m_frame = frame;
+
+    // Retired in frame order so everything that can go is at the front
+    while (!m_retired.empty() && m_retired.front().when <= completedFrame)
+    {
+        m_retired.front().region->ranges.free(m_retired.front().offset);
+        m_retired.pop_front();
+        m_compact = false;  // a new hole, something might fit in it now
+    }
+}
+
+bool GeometryPool::defragment(VkCommandBuffer cmd, VkDeviceSize byteBudget)
+{
+    m_moved.clear();
+    if (m_compact) return false;
+
+    std::vector<VkBufferCopy> vertexCopies, indexCopies;
+    VkDeviceSize moved = defragmentRegion(m_vertices, byteBudget, vertexCopies);
+    moved += defragmentRegion(m_indices, byteBudget > moved ? byteBudget - moved : 0, indexCopies);
+
+    if (vertexCopies.empty() && indexCopies.empty())
+    {
+        // Stays this way until something is freed, no point searching every frame
+        // (ranges bigger than the whole budget are never moved)
+        m_compact = true;
+        return false;
+    }
+    m_version++;
+
+    // Previous frames may still be reading the holes we're about to write (WAR) and earlier uploads
+    // may have just written the ranges we're about to read
+    VkMemoryBarrier beforeCopy =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+    };
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        1, &beforeCopy,
+        0, nullptr,
+        0, nullptr
+    );
+
+    // Source and destination never overlap, sources are live ranges and destinations were free
+    if (!vertexCopies.empty())
+    {
+        vkCmdCopyBuffer(cmd, m_vertices.buffer, m_vertices.buffer, static_cast<uint32_t>(vertexCopies.size()), vertexCopies.data());
+    }
+    if (!indexCopies.empty())
+    {
+        vkCmdCopyBuffer(cmd, m_indices.buffer, m_indices.buffer, static_cast<uint32_t>(indexCopies.size()), indexCopies.data());
+    }
+
+    VkMemoryBarrier afterCopy =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT
+    };
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        0,
+        1, &afterCopy,
+        0, nullptr,
+        0, nullptr
+    );
+
+    return true;
+}
+
+uint64_t GeometryPool::getVersion() const
+{
+    return m_version;
+}
+
+const std::vector<GeometryHandle>& GeometryPool::getMovedHandles() const
+{
+    return m_moved;
+}
+
+void GeometryPool::releaseMoves(uint64_t version)
+{
+    // Nothing records with the old offsets anymore, once the frames that did are done the ranges are free
+    while (!m_movedFrom.empty() && m_movedFrom.front().when <= version)
+    {
+        m_retired.push_back({ m_movedFrom.front().region, m_movedFrom.front().offset, m_frame });
+        m_movedFrom.pop_front();
+    }
+}
+
+bool GeometryPool::canWriteDirect() const
+{
+    // Both buffers have to have landed in mapped coherent memory, we don't flush
+    auto writable = [this](const Allocation& memory)
+    {
+        return memory.mapped != nullptr &&
+            (m_allocator->getMemoryTypes().getFlags(memory.memoryType) & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    };
+    return writable(m_vertices.memory) && writable(m_indices.memory);
+}
+
+void GeometryPool::setDirectWrite(bool enable)
+{
+    m_directWrite = enable && canWriteDirect();
+}
+
+const UploadStats& GeometryPool::getUploadStats() const
+{
+    return m_stats;
+}
+
+VkBuffer GeometryPool::getVertexBuffer()
+{
+    return m_vertices.buffer;
+}
+
+VkDeviceAddress GeometryPool::getVertexAddress()
+{
+    return m_allocator->getBufferAddress(m_vertices.buffer);
+}
+
+VkBuffer GeometryPool::getIndexBuffer()
+{
+    return m_indices.buffer;
+}
+
+void GeometryPool::createRegion(Region& region, VkDeviceSize stride, uint32_t capacity, VkBufferUsageFlags usage, const MemoryPreferences& prefs, const char* owner)
+{
+    VkDeviceSize bufferSize = VkDeviceSize(capacity) * stride;
+    m_allocator->createBuffer(bufferSize, usage, prefs, &region.buffer, &region.memory, owner);
+
+    region.ranges = RangeAllocator(bufferSize);
+    region.stride = stride;
+}
+
+bool GeometryPool::allocateRange(Region& region, uint32_t count, GeometryHandle handle, uint32_t* first)
+{
+    *first = 0;
+    if (count == 0) return true;
+
+    // Aligning to the stride keeps every range a whole number of elements from the start of the buffer
+    VkDeviceSize offset;
+    if (!region.ranges.allocate(VkDeviceSize(count) * region.stride, region.stride, ResourceKind::Linear, &offset))
+    {
+        return false;
+    }
+    region.owners[offset] = handle;
+    *first = static_cast<uint32_t>(offset / region.stride);
+    return true;
+}
+
+void GeometryPool::retireRange(Region& region, uint32_t first, uint32_t count)
+{
+    if (count == 0) return;
+
+    VkDeviceSize offset = VkDeviceSize(first) * region.stride;
+    region.owners.erase(offset);
+    m_retired.push_back({ &region, offset, m_frame });
+}
+
+VkDeviceSize GeometryPool::defragmentRegion(Region& region, VkDeviceSize byteBudget, std::vector<VkBufferCopy>& copies)
+{
+    // Walk the live ranges from the top down and move each into the lowest hole below it that fits
+    VkDeviceSize moved = 0;
+    VkDeviceSize limit = region.ranges.getSize();
+    VkDeviceSize offset, size;
+    while (moved < byteBudget && region.ranges.findUsedBelow(limit, &offset, &size))
+    {
+        limit = offset;
+
+        // Retired/moved-from ranges aren't owned by anyone, they just wait to be freed
+        auto owner = region.owners.find(offset);
+        if (owner == region.owners.end() || moved + size > byteBudget) continue;
+
+        VkDeviceSize newOffset;
+        if (!region.ranges.allocateBelow(size, region.stride, ResourceKind::Linear, offset, &newOffset)) continue;
+
+        copies.push_back({ .srcOffset = offset, .dstOffset = newOffset, .size = size });
+        moved += size;
+
+        GeometryHandle handle = owner->second;
+        region.owners.erase(owner);
+        region.owners[newOffset] = handle;
+
+        uint32_t first = static_cast<uint32_t>(newOffset / region.stride);
+        if (&region == &m_vertices)
+        {
+            m_handles[handle].firstVertex = first;
+        }
+        else
+        {
+            m_handles[handle].firstIndex = first;
+        }
+        m_moved.push_back(handle);
+
+        // Draws recorded before this step still read the old range
+        m_movedFrom.push_back({ &region, offset, m_version + 1 });
+    }
+    return moved;
+}
+
+void GeometryPool::upload(TransferContext* transfer, const void* data, VkDeviceSize size, Region& region, VkDeviceSize dstOffset)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if (m_directWrite)
+    {
+        // Coherent host writes are visible to the device at the next queue submit, nothing else to do
+        memcpy(static_cast<char*>(region.memory.mapped) + dstOffset, data, static_cast<size_t>(size));
+    }
+    else
+    {
+        transfer->upload(data, size, region.buffer, dstOffset);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (m_directWrite)
+    {
+        m_stats.directUploads++;
+        m_stats.directBytes += size;
+        m_stats.directSeconds += elapsed.count();
+    }
+    else
+    {
+        m_stats.stagedUploads++;
+        m_stats.stagedBytes += size;
+        m_stats.stagedSeconds += elapsed.count();
+    }
+}
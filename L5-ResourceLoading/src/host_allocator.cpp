@@ -0,0 +1,286 @@
+#include "host_allocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static uintptr_t alignUp(uintptr_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void HostAllocator::init(size_t arenaChunkSize)
+{
+    m_arenaChunkSize = arenaChunkSize;
+
+    m_callbacks =
+    {
+        .pUserData = this,
+        .pfnAllocation = allocationCallback,
+        .pfnReallocation = reallocationCallback,
+        .pfnFree = freeCallback,
+        .pfnInternalAllocation = internalAllocationCallback,
+        .pfnInternalFree = internalFreeCallback
+    };
+}
+
+void HostAllocator::destroy()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto& arena : m_arenas)
+    {
+        for (auto chunk : arena.chunks)
+        {
+            std::free(chunk->memory);
+            delete chunk;
+        }
+        if (arena.spare != nullptr)
+        {
+            std::free(arena.spare->memory);
+            delete arena.spare;
+        }
+        arena = Arena();
+    }
+    for (auto& pool : m_pools)
+    {
+        for (auto slab : pool.slabs)
+        {
+            std::free(slab);
+        }
+        pool = Pool();
+    }
+}
+
+const VkAllocationCallbacks* HostAllocator::getCallbacks() const
+{
+    return &m_callbacks;
+}
+
+HostScopeStats HostAllocator::getStats(VkSystemAllocationScope scope) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats[scope];
+}
+
+void* HostAllocator::allocate(size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if (size == 0) return nullptr;
+    alignment = std::max(alignment, alignof(Header));
+
+    // Worst case room for the header plus padding up to the alignment
+    size_t needed = size + sizeof(Header) + (alignment - alignof(Header));
+
+    void* base = nullptr;
+    void* chunk = nullptr;
+    uint32_t sizeClass = LARGE_ALLOCATION;
+
+    bool arenaScope = scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND ||
+        scope == VK_SYSTEM_ALLOCATION_SCOPE_DEVICE ||
+        scope == VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE;
+
+    if (arenaScope && needed <= m_arenaChunkSize / 4)
+    {
+        // Short lived (command) or freed all together (device/instance), bumping is all we need
+        allocateFromArena(m_arenas[scope], needed, alignof(Header), &chunk, &base);
+        sizeClass = ARENA_ALLOCATION;
+    }
+    else if (!arenaScope && needed <= (MIN_SIZE_CLASS << (SIZE_CLASS_COUNT - 1)))
+    {
+        sizeClass = 0;
+        while ((MIN_SIZE_CLASS << sizeClass) < needed) sizeClass++;
+        base = allocateFromPool(sizeClass);
+    }
+    else
+    {
+        base = std::malloc(needed);
+    }
+
+    if (base == nullptr) return nullptr;
+
+    uintptr_t memory = alignUp(reinterpret_cast<uintptr_t>(base) + sizeof(Header), alignment);
+    Header* header = reinterpret_cast<Header*>(memory) - 1;
+    *header =
+    {
+        .base = base,
+        .chunk = chunk,
+        .size = size,
+        .scope = static_cast<uint32_t>(scope),
+        .sizeClass = sizeClass
+    };
+
+    HostScopeStats& stats = m_stats[scope];
+    stats.allocations++;
+    stats.liveBytes += size;
+    stats.totalBytes += size;
+    stats.peakBytes = std::max(stats.peakBytes, stats.liveBytes);
+
+    return reinterpret_cast<void*>(memory);
+}
+
+void* HostAllocator::reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if (original == nullptr) return allocate(size, alignment, scope);
+    if (size == 0)
+    {
+        free(original);
+        return nullptr;
+    }
+
+    // Always a fresh allocation, drivers rarely reallocate so it's not worth growing in place
+    size_t originalSize = (reinterpret_cast<Header*>(original) - 1)->size;
+    void* memory = allocate(size, alignment, scope);
+    if (memory == nullptr) return nullptr;     // the original stays valid on failure
+
+    memcpy(memory, original, std::min(originalSize, size));
+    free(original);
+
+    // allocate counted this as a brand new allocation, the free of the original stays counted
+    m_stats[scope].allocations--;
+    m_stats[scope].reallocations++;
+    return memory;
+}
+
+void HostAllocator::free(void* memory)
+{
+    if (memory == nullptr) return;
+
+    Header header = *(reinterpret_cast<Header*>(memory) - 1);
+    if (header.sizeClass == ARENA_ALLOCATION)
+    {
+        freeToArena(m_arenas[header.scope], static_cast<ArenaChunk*>(header.chunk));
+    }
+    else if (header.sizeClass == LARGE_ALLOCATION)
+    {
+        std::free(header.base);
+    }
+    else
+    {
+        m_pools[header.sizeClass].freeSlots.push_back(header.base);
+    }
+
+    HostScopeStats& stats = m_stats[header.scope];
+    stats.frees++;
+    stats.liveBytes -= header.size;
+}
+
+void* HostAllocator::allocateFromArena(Arena& arena, size_t size, size_t alignment, void** chunk, void** base)
+{
+    ArenaChunk* current = arena.current;
+    if (current == nullptr || alignUp(current->used, alignment) + size > m_arenaChunkSize)
+    {
+        // Start a new chunk, the old one goes away by itself once its last allocation is freed
+        if (current != nullptr && current->live == 0)
+        {
+            current->used = 0;
+        }
+        else
+        {
+            if (arena.spare != nullptr)
+            {
+                current = arena.spare;
+                arena.spare = nullptr;
+            }
+            else
+            {
+                current = new ArenaChunk{ static_cast<char*>(std::malloc(m_arenaChunkSize)), 0, 0 };
+                if (current->memory == nullptr)
+                {
+                    delete current;
+                    return nullptr;
+                }
+            }
+            arena.chunks.push_back(current);
+            arena.current = current;
+        }
+    }
+
+    size_t offset = alignUp(current->used, alignment);
+    current->used = offset + size;
+    current->live++;
+
+    *chunk = current;
+    *base = current->memory + offset;
+    return *base;
+}
+
+void HostAllocator::freeToArena(Arena& arena, ArenaChunk* chunk)
+{
+    if (--chunk->live > 0) return;
+
+    if (chunk == arena.current)
+    {
+        // Everything in the current chunk is gone, just start bumping from the front again
+        chunk->used = 0;
+        return;
+    }
+
+    arena.chunks.erase(std::find(arena.chunks.begin(), arena.chunks.end(), chunk));
+    chunk->used = 0;
+    if (arena.spare == nullptr)
+    {
+        arena.spare = chunk;
+    }
+    else
+    {
+        std::free(chunk->memory);
+        delete chunk;
+    }
+}
+
+void* HostAllocator::allocateFromPool(uint32_t sizeClass)
+{
+    Pool& pool = m_pools[sizeClass];
+    if (pool.freeSlots.empty())
+    {
+        // Cut a new slab into slots of this class
+        char* slab = static_cast<char*>(std::malloc(POOL_SLAB_SIZE));
+        if (slab == nullptr) return nullptr;
+        pool.slabs.push_back(slab);
+
+        size_t slotSize = MIN_SIZE_CLASS << sizeClass;
+        for (size_t offset = 0; offset + slotSize <= POOL_SLAB_SIZE; offset += slotSize)
+        {
+            pool.freeSlots.push_back(slab + offset);
+        }
+    }
+
+    void* slot = pool.freeSlots.back();
+    pool.freeSlots.pop_back();
+    return slot;
+}
+
+void* VKAPI_PTR HostAllocator::allocationCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    HostAllocator* allocator = static_cast<HostAllocator*>(userData);
+    std::lock_guard<std::mutex> lock(allocator->m_mutex);
+    return allocator->allocate(size, alignment, scope);
+}
+
+void* VKAPI_PTR HostAllocator::reallocationCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    HostAllocator* allocator = static_cast<HostAllocator*>(userData);
+    std::lock_guard<std::mutex> lock(allocator->m_mutex);
+    return allocator->reallocate(original, size, alignment, scope);
+}
+
+void VKAPI_PTR HostAllocator::freeCallback(void* userData, void* memory)
+{
+    HostAllocator* allocator = static_cast<HostAllocator*>(userData);
+    std::lock_guard<std::mutex> lock(allocator->m_mutex);
+    allocator->free(memory);
+}
+
+void VKAPI_PTR HostAllocator::internalAllocationCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+    HostAllocator* allocator = static_cast<HostAllocator*>(userData);
+    std::lock_guard<std::mutex> lock(allocator->m_mutex);
+    allocator->m_stats[scope].internalBytes += size;
+}
+
+void VKAPI_PTR HostAllocator::internalFreeCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+    HostAllocator* allocator = static_cast<HostAllocator*>(userData);
+    std::lock_guard<std::mutex> lock(allocator->m_mutex);
+    allocator->m_stats[scope].internalBytes -= size;
+}
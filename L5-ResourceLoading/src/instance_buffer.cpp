@@ -0,0 +1,36 @@
+#include "instance_buffer.h"
+
+#include <stdexcept>
+
+void InstanceBuffer::init(DeviceAllocator* allocator, uint32_t frameCount, uint32_t capacity)
+{
+    m_capacity = capacity;
+    m_buffer.init(
+        allocator,
+        frameCount,
+        VkDeviceSize(capacity) * sizeof(InstanceData),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        "instances"
+    );
+}
+
+void InstanceBuffer::destroy()
+{
+    m_buffer.destroy();
+}
+
+void InstanceBuffer::write(const std::vector<InstanceData>& instances)
+{
+    if (instances.size() > m_capacity)
+    {
+        throw std::runtime_error("Too many instances for the instance buffer");
+    }
+    m_instances = instances;
+    m_buffer.markDirty(0, m_instances.size() * sizeof(InstanceData));
+}
+
+VkDescriptorBufferInfo InstanceBuffer::prepareFrame(uint32_t frameIndex)
+{
+    m_buffer.flush(frameIndex, m_instances.data(), m_instances.size() * sizeof(InstanceData));
+    return m_buffer.getFrame(frameIndex);
+}
@@ -2,11 +2,12 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
 #include <iostream>
 #include <stdlib.h>
-#include <thread>
+#include <string>
 
 #include "vulkan_renderer.h"
 
@@ -16,21 +17,30 @@ GLFWwindow* initWindow(
     const unsigned int height = 600
 );
 
-int main()
+int main(int argc, char** argv)
 {
+    // e.g. "runme low-latency" or "runme power-saving --staged-uploads --vertex-pulling --frames-in-flight 3"
+    // smooth present, direct uploads, a vertex binding and the policy's frames in flight otherwise
+    RendererSettings settings;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "low-latency") settings.presentPolicy = PresentPolicy::LowLatency;
+        else if (arg == "power-saving") settings.presentPolicy = PresentPolicy::PowerSaving;
+        else if (arg == "--staged-uploads") settings.stagedUploads = true;
+        else if (arg == "--vertex-pulling") settings.vertexPulling = true;
+        else if (arg == "--frames-in-flight" && i + 1 < argc) settings.framesInFlight = std::max(1, atoi(argv[++i]));
+    }
+
     GLFWwindow* window = initWindow();
 
     VulkanRenderer vkrender = VulkanRenderer();
-    if (vkrender.init(window) == EXIT_FAILURE) return EXIT_FAILURE;
+    if (vkrender.init(window, settings) == EXIT_FAILURE) return EXIT_FAILURE;
 
     while(!glfwWindowShouldClose(window))
     {
         glfwPollEvents();
         vkrender.draw();
-
-        // Needed to prevent simultaneous use of command buffers
-        // Seems like image isn't being locked until some time after it is acquired
-        //std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
 
     vkrender.destroy();
@@ -45,7 +55,7 @@ GLFWwindow* initWindow(const std::string& name, const unsigned int width, const
     glfwInit();
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
 
     return glfwCreateWindow(width, height, name.c_str(), nullptr, nullptr);
@@ -0,0 +1,78 @@
+#include "memory_tracker.h"
+
+#include <algorithm>
+
+static void add(MemoryUsage& usage, VkDeviceSize size)
+{
+    usage.bytes += size;
+    usage.count++;
+    usage.created++;
+    usage.peakBytes = std::max(usage.peakBytes, usage.bytes);
+    usage.peakCount = std::max(usage.peakCount, usage.count);
+}
+
+static void remove(MemoryUsage& usage, VkDeviceSize size)
+{
+    usage.bytes -= size;
+    usage.count--;
+    usage.destroyed++;
+}
+
+void MemoryTracker::track(TrackedType type, uint64_t handle, const std::string& owner, VkDeviceSize size, uint32_t memoryType, uint32_t heap)
+{
+    m_live[{ type, handle }] =
+    {
+        .type = type,
+        .handle = handle,
+        .owner = owner,
+        .size = size,
+        .memoryType = memoryType,
+        .heap = heap,
+        .serial = m_nextSerial++
+    };
+
+    add(m_heaps[heap], size);
+    add(m_types[static_cast<size_t>(type)], size);
+    add(m_owners[owner], size);
+}
+
+void MemoryTracker::untrack(TrackedType type, uint64_t handle)
+{
+    auto live = m_live.find({ type, handle });
+    if (live == m_live.end()) return;
+
+    const TrackedResource& resource = live->second;
+    remove(m_heaps[resource.heap], resource.size);
+    remove(m_types[static_cast<size_t>(type)], resource.size);
+    remove(m_owners[resource.owner], resource.size);
+    m_live.erase(live);
+}
+
+MemoryUsage MemoryTracker::getHeapUsage(uint32_t heap) const
+{
+    return m_heaps[heap];
+}
+
+MemoryUsage MemoryTracker::getTypeUsage(TrackedType type) const
+{
+    return m_types[static_cast<size_t>(type)];
+}
+
+const std::map<std::string, MemoryUsage>& MemoryTracker::getOwnerUsage() const
+{
+    return m_owners;
+}
+
+std::vector<TrackedResource> MemoryTracker::getLiveResources() const
+{
+    std::vector<TrackedResource> resources;
+    for (auto& live : m_live)
+    {
+        resources.push_back(live.second);
+    }
+    std::sort(resources.begin(), resources.end(), [](const TrackedResource& a, const TrackedResource& b)
+    {
+        return a.serial < b.serial;
+    });
+    return resources;
+}
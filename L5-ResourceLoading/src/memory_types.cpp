@@ -0,0 +1,133 @@
+#include "memory_types.h"
+
+#include <algorithm>
+#include <bitset>
+
+void MemoryTypeSelector::init(VkPhysicalDevice physical, bool budgetExtension)
+{
+    m_physicalDevice = physical;
+    m_budgetExtension = budgetExtension;
+
+    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &m_memoryProps);
+
+    // Without VK_EXT_memory_budget the best we can do is assume we get most of each heap to ourselves
+    for (uint32_t i = 0; i < m_memoryProps.memoryHeapCount; i++)
+    {
+        m_driverBudget[i] = m_memoryProps.memoryHeaps[i].size / 10 * 8;
+    }
+
+    refreshBudget();
+}
+
+void MemoryTypeSelector::refreshBudget()
+{
+    if (!m_budgetExtension) return;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT
+    };
+    VkPhysicalDeviceMemoryProperties2 memoryProps2 =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+        .pNext = &budgetProps
+    };
+    vkGetPhysicalDeviceMemoryProperties2(m_physicalDevice, &memoryProps2);
+
+    for (uint32_t i = 0; i < m_memoryProps.memoryHeapCount; i++)
+    {
+        m_driverBudget[i] = budgetProps.heapBudget[i];
+        m_driverUsage[i] = budgetProps.heapUsage[i];
+        m_ownUsageAtRefresh[i] = m_ownUsage[i];
+    }
+}
+
+std::vector<uint32_t> MemoryTypeSelector::getCandidates(uint32_t allowedTypes, VkMemoryPropertyFlags flags) const
+{
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < m_memoryProps.memoryTypeCount; i++)
+    {
+        if ((allowedTypes & (1ul << i)) && (m_memoryProps.memoryTypes[i].propertyFlags & flags) == flags)
+        {
+            candidates.push_back(i);
+        }
+    }
+
+    // e.g. if we only asked for DEVICE_LOCAL don't burn the small DEVICE_LOCAL | HOST_VISIBLE (BAR) heap first
+    std::stable_sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+        auto extraA = std::bitset<32>(m_memoryProps.memoryTypes[a].propertyFlags & ~flags).count();
+        auto extraB = std::bitset<32>(m_memoryProps.memoryTypes[b].propertyFlags & ~flags).count();
+        return extraA < extraB;
+    });
+
+    return candidates;
+}
+
+bool MemoryTypeSelector::hasBudget(uint32_t memoryType, VkDeviceSize size) const
+{
+    HeapBudget heap = getHeapBudget(m_memoryProps.memoryTypes[memoryType].heapIndex);
+    return heap.usage + size <= heap.budget;
+}
+
+void MemoryTypeSelector::trackAllocation(uint32_t memoryType, VkDeviceSize size)
+{
+    m_ownUsage[m_memoryProps.memoryTypes[memoryType].heapIndex] += size;
+}
+
+void MemoryTypeSelector::trackFree(uint32_t memoryType, VkDeviceSize size)
+{
+    m_ownUsage[m_memoryProps.memoryTypes[memoryType].heapIndex] -= size;
+}
+
+const VkPhysicalDeviceMemoryProperties& MemoryTypeSelector::getProperties() const
+{
+    return m_memoryProps;
+}
+
+VkMemoryPropertyFlags MemoryTypeSelector::getFlags(uint32_t memoryType) const
+{
+    return m_memoryProps.memoryTypes[memoryType].propertyFlags;
+}
+
+HeapBudget MemoryTypeSelector::getHeapBudget(uint32_t heapIndex) const
+{
+    if (!m_budgetExtension)
+    {
+        return { m_driverBudget[heapIndex], m_ownUsage[heapIndex] };
+    }
+
+    // The driver numbers are only as fresh as the last refresh so add on what we did since then
+    VkDeviceSize usage = m_driverUsage[heapIndex];
+    if (m_ownUsage[heapIndex] >= m_ownUsageAtRefresh[heapIndex])
+    {
+        usage += m_ownUsage[heapIndex] - m_ownUsageAtRefresh[heapIndex];
+    }
+    else
+    {
+        usage -= std::min(usage, m_ownUsageAtRefresh[heapIndex] - m_ownUsage[heapIndex]);
+    }
+    return { m_driverBudget[heapIndex], usage };
+}
+
+bool MemoryTypeSelector::hasUnifiedMemory() const
+{
+    VkDeviceSize largestDeviceHeap = 0;
+    for (uint32_t i = 0; i < m_memoryProps.memoryHeapCount; i++)
+    {
+        if (m_memoryProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        {
+            largestDeviceHeap = std::max(largestDeviceHeap, m_memoryProps.memoryHeaps[i].size);
+        }
+    }
+
+    const VkMemoryPropertyFlags wanted = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    for (uint32_t i = 0; i < m_memoryProps.memoryTypeCount; i++)
+    {
+        const VkMemoryType& type = m_memoryProps.memoryTypes[i];
+        if ((type.propertyFlags & wanted) == wanted && m_memoryProps.memoryHeaps[type.heapIndex].size == largestDeviceHeap)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -1,12 +1,18 @@
 #include "mesh.h"
 
-Mesh::Mesh(VkPhysicalDevice phys, VkDevice log, VkQueue transferQueue, VkCommandPool transferCmdPool, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices):
-m_physicalDevice(phys), m_logicalDevice(log)
+#include <algorithm>
+#include <limits>
+
+Mesh::Mesh(GeometryPool* pool, TransferContext* transfer, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices):
+m_pool(pool)
 {
     m_vertexCount = vertices->size();
     m_indexCount = indices->size();
-    createVertexBuffer(transferQueue, transferCmdPool, vertices);
-    createIndexBuffer(transferQueue, transferCmdPool, indices);
+    m_geometry = m_pool->allocate(m_vertexCount, m_indexCount);
+
+    computeBounds(vertices);
+    createVertexBuffer(transfer, vertices);
+    createIndexBuffer(transfer, indices);
 }
 
 int Mesh::getVertexCount()
@@ -18,112 +24,157 @@ int Mesh::getIndexCount()
     return m_indexCount;
 }
 
+uint32_t Mesh::getFirstIndex()
+{
+    return m_pool->getRange(m_geometry).firstIndex;
+}
+
+int32_t Mesh::getVertexOffset()
+{
+    return static_cast<int32_t>(m_pool->getRange(m_geometry).firstVertex);
+}
+
+VkDrawIndexedIndirectCommand Mesh::getDrawCommand()
+{
+    VkDrawIndexedIndirectCommand command = m_pool->getDrawCommand(m_geometry);
+    command.instanceCount = static_cast<uint32_t>(m_instances.size());
+    command.firstInstance = m_firstInstance;
+    return command;
+}
+
+GeometryHandle Mesh::getGeometry()
+{
+    return m_geometry;
+}
+
 VkBuffer Mesh::getVertexBuffer()
 {
-    return m_vertexBuffer;
+    return m_pool->getVertexBuffer();
 }
 
 VkBuffer Mesh::getIndexBuffer()
 {
-    return m_indexBuffer;
+    return m_pool->getIndexBuffer();
+}
+
+VkDeviceAddress Mesh::getVertexAddress()
+{
+    return m_pool->getVertexAddress() + VkDeviceSize(m_pool->getRange(m_geometry).firstVertex) * sizeof(Vertex);
+}
+
+VertexLayout Mesh::getVertexLayout()
+{
+    // The pool only holds Vertex so far
+    return VERTEX_LAYOUT_POSITION_COLOR;
+}
+
+glm::vec4 Mesh::getBounds()
+{
+    if (m_instanceBoundsValid) return m_instanceBounds;
+    m_instanceBoundsValid = true;
+
+    // Move the sphere to every instance (scaled by its largest axis), then put one sphere around all of those
+    std::vector<glm::vec4> spheres;
+    glm::vec3 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+    for (auto& instance : m_instances)
+    {
+        glm::mat4 transform = m_transform * instance.transform;
+        glm::vec3 centre = glm::vec3(transform * glm::vec4(glm::vec3(m_bounds), 1.0f));
+        float scale = std::max({
+            glm::length(glm::vec3(transform[0])),
+            glm::length(glm::vec3(transform[1])),
+            glm::length(glm::vec3(transform[2]))
+        });
+        float radius = m_bounds.w * scale;
+        spheres.push_back(glm::vec4(centre, radius));
+        low = glm::min(low, centre - radius);
+        high = glm::max(high, centre + radius);
+    }
+    if (spheres.empty())
+    {
+        m_instanceBounds = glm::vec4(0.0f);
+        return m_instanceBounds;
+    }
+
+    glm::vec3 centre = (low + high) * 0.5f;
+    float radius = 0.0f;
+    for (auto& sphere : spheres)
+    {
+        radius = std::max(radius, glm::length(glm::vec3(sphere) - centre) + sphere.w);
+    }
+    m_instanceBounds = glm::vec4(centre, radius);
+    return m_instanceBounds;
+}
+
+const glm::mat4& Mesh::getTransform()
+{
+    return m_transform;
+}
+
+void Mesh::setTransform(const glm::mat4& transform)
+{
+    m_transform = transform;
+    m_instanceBoundsValid = false;
+}
+
+void Mesh::addInstance(const glm::mat4& transform, const glm::vec4& color)
+{
+    m_instances.push_back({ transform, color });
+    m_instanceBoundsValid = false;
+}
+
+const std::vector<InstanceData>& Mesh::getInstances()
+{
+    return m_instances;
+}
+
+uint32_t Mesh::getFirstInstance()
+{
+    return m_firstInstance;
+}
+
+void Mesh::setFirstInstance(uint32_t firstInstance)
+{
+    m_firstInstance = firstInstance;
+}
+
+VkDeviceSize Mesh::getMemoryUsage()
+{
+    return sizeof(Vertex)*m_vertexCount + sizeof(uint32_t)*m_indexCount;
 }
 
 void Mesh::destroyVertexBuffer()
 {
-    vkDestroyBuffer(m_logicalDevice, m_vertexBuffer, nullptr);
-    vkFreeMemory(m_logicalDevice, m_vertexBufferMemory, nullptr);
-    vkDestroyBuffer(m_logicalDevice, m_indexBuffer, nullptr);
-    vkFreeMemory(m_logicalDevice, m_indexBufferMemory, nullptr);
-}
-
-void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCmdPool, std::vector<Vertex>* vertices)
-{
-    VkDeviceSize bufferSize = sizeof(Vertex)*vertices->size();
-
-    // Create Staging SRC Buffer
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(
-        m_physicalDevice,
-        m_logicalDevice,
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &stagingBuffer,
-        &stagingBufferMemory
-    );
-
-    void* data;
-    vkMapMemory(
-        m_logicalDevice,
-        stagingBufferMemory,
-        0,
-        bufferSize,
-        0,
-        &data
-    );
-    memcpy(data, (void*)(vertices->data()), static_cast<size_t>(bufferSize));
-    vkUnmapMemory(m_logicalDevice, stagingBufferMemory);
-
-    // Create Vertex Buffer (Staging DST Buffer)
-    createBuffer(
-        m_physicalDevice,
-        m_logicalDevice,
-        bufferSize,
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        &m_vertexBuffer,
-        &m_vertexBufferMemory
-    );
-
-    copyBuffer(m_logicalDevice, transferQueue, transferCmdPool, stagingBuffer, m_vertexBuffer, bufferSize);
-
-    vkDestroyBuffer(m_logicalDevice, stagingBuffer, nullptr);
-    vkFreeMemory(m_logicalDevice, stagingBufferMemory, nullptr);
-}
-
-void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCmdPool, std::vector<uint32_t>* indices)
-{
-    VkDeviceSize bufferSize = sizeof(uint32_t)*indices->size();
-
-    // Create Staging SRC Buffer
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(
-        m_physicalDevice,
-        m_logicalDevice,
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &stagingBuffer,
-        &stagingBufferMemory
-    );
-
-    void* data;
-    vkMapMemory(
-        m_logicalDevice,
-        stagingBufferMemory,
-        0,
-        bufferSize,
-        0,
-        &data
-    );
-    memcpy(data, (void*)(indices->data()), static_cast<size_t>(bufferSize));
-    vkUnmapMemory(m_logicalDevice, stagingBufferMemory);
-
-    // Create Index Buffer (Staging DST Buffer)
-    createBuffer(
-        m_physicalDevice,
-        m_logicalDevice,
-        bufferSize,
-        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        &m_indexBuffer,
-        &m_indexBufferMemory
-    );
-
-    copyBuffer(m_logicalDevice, transferQueue, transferCmdPool, stagingBuffer, m_indexBuffer, bufferSize);
-
-    vkDestroyBuffer(m_logicalDevice, stagingBuffer, nullptr);
-    vkFreeMemory(m_logicalDevice, stagingBufferMemory, nullptr);
+    m_pool->free(m_geometry);
 }
+
+void Mesh::createVertexBuffer(TransferContext* transfer, std::vector<Vertex>* vertices)
+{
+    // Copy the vertices into our range of the shared vertex buffer
+    m_pool->uploadVertices(transfer, m_geometry, vertices->data());
+}
+
+void Mesh::createIndexBuffer(TransferContext* transfer, std::vector<uint32_t>* indices)
+{
+    // Copy the indices into our range of the shared index buffer
+    m_pool->uploadIndices(transfer, m_geometry, indices->data());
+}
+
+void Mesh::computeBounds(std::vector<Vertex>* vertices)
+{
+    // Centre of the box around the vertices and the farthest vertex from it, not the tightest sphere but close enough to cull with
+    glm::vec3 low = vertices->empty() ? glm::vec3(0.0f) : vertices->front().position;
+    glm::vec3 high = low;
+    for (auto& vertex : *vertices)
+    {
+        low = glm::min(low, vertex.position);
+        high = glm::max(high, vertex.position);
+    }
+    glm::vec3 centre = (low + high) * 0.5f;
+    float radius = 0.0f;
+    for (auto& vertex : *vertices)
+    {
+        radius = std::max(radius, glm::length(vertex.position - centre));
+    }
+    m_bounds = glm::vec4(centre, radius);
+}
\ No newline at end of file
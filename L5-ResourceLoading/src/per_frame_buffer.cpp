@@ -0,0 +1,89 @@
+#include "per_frame_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+// The largest any of the buffer offset alignment limits is allowed to be, so every segment can be
+// bound on its own whatever the buffer is used as
+const VkDeviceSize SEGMENT_ALIGNMENT = 256;
+
+void PerFrameBuffer::init(DeviceAllocator* allocator, uint32_t frameCount, VkDeviceSize frameSize, VkBufferUsageFlags usage, const char* owner)
+{
+    m_allocator = allocator;
+    m_frameSize = frameSize;
+    VkDeviceSize stride = (frameSize + SEGMENT_ALIGNMENT - 1) / SEGMENT_ALIGNMENT * SEGMENT_ALIGNMENT;
+
+    // Read by the GPU straight from where the CPU wrote it, device local if it can be mapped
+    m_allocator->createBuffer(
+        stride * frameCount,
+        usage,
+        {
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        },
+        &m_buffer,
+        &m_memory,
+        owner
+    );
+
+    m_segments.resize(frameCount);
+    for (uint32_t i = 0; i < frameCount; i++)
+    {
+        m_segments[i].offset = stride * i;
+    }
+}
+
+void PerFrameBuffer::destroy()
+{
+    m_allocator->destroyBuffer(m_buffer, m_memory);
+    m_segments.clear();
+}
+
+void PerFrameBuffer::markDirty(VkDeviceSize offset, VkDeviceSize size)
+{
+    for (auto& segment : m_segments)
+    {
+        if (segment.dirtyBegin == segment.dirtyEnd)
+        {
+            segment.dirtyBegin = offset;
+            segment.dirtyEnd = offset + size;
+        }
+        else
+        {
+            segment.dirtyBegin = std::min(segment.dirtyBegin, offset);
+            segment.dirtyEnd = std::max(segment.dirtyEnd, offset + size);
+        }
+    }
+}
+
+void PerFrameBuffer::flush(uint32_t frameIndex, const void* data, VkDeviceSize size)
+{
+    Segment& segment = m_segments[frameIndex];
+
+    VkDeviceSize end = std::min(segment.dirtyEnd, size);
+    if (segment.dirtyBegin < end)
+    {
+        memcpy(
+            static_cast<char*>(getMapped(frameIndex)) + segment.dirtyBegin,
+            static_cast<const char*>(data) + segment.dirtyBegin,
+            end - segment.dirtyBegin
+        );
+    }
+    segment.dirtyBegin = 0;
+    segment.dirtyEnd = 0;
+}
+
+VkDescriptorBufferInfo PerFrameBuffer::getFrame(uint32_t frameIndex) const
+{
+    return { m_buffer, m_segments[frameIndex].offset, m_frameSize };
+}
+
+void* PerFrameBuffer::getMapped(uint32_t frameIndex) const
+{
+    return static_cast<char*>(m_memory.mapped) + m_segments[frameIndex].offset;
+}
+
+VkBuffer PerFrameBuffer::getBuffer() const
+{
+    return m_buffer;
+}
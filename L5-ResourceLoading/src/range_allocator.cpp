@@ -0,0 +1,174 @@
+#include "range_allocator.h"
+
+#include <algorithm>
+#include <iterator>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Two ranges are on the same granularity page if the last byte of one and the first byte of the other are
+static bool onSamePage(VkDeviceSize endOfFirst, VkDeviceSize startOfSecond, VkDeviceSize granularity)
+{
+    return ((endOfFirst - 1) / granularity) == (startOfSecond / granularity);
+}
+
+RangeAllocator::RangeAllocator(VkDeviceSize size, VkDeviceSize granularity):
+m_size(size), m_granularity(granularity > 0 ? granularity : 1)
+{
+    insertFree(0, size);
+}
+
+bool RangeAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind, VkDeviceSize* offset)
+{
+    if (size == 0) return false;
+    if (alignment == 0) alignment = 1;
+
+    // Best fit: start at the smallest free range that could hold the request
+    // and walk up until alignment and granularity padding still leave enough room
+    for (auto candidate = m_freeBySize.lower_bound({ size, 0 }); candidate != m_freeBySize.end(); candidate++)
+    {
+        VkDeviceSize freeStart = candidate->second;
+        VkDeviceSize freeEnd = freeStart + candidate->first;
+        VkDeviceSize start;
+        if (!fit(freeStart, freeEnd, size, alignment, kind, &start)) continue;
+
+        take(freeStart, freeEnd, start, size, kind);
+        *offset = start;
+        return true;
+    }
+
+    return false;
+}
+
+bool RangeAllocator::allocateBelow(VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind, VkDeviceSize limit, VkDeviceSize* offset)
+{
+    if (size == 0) return false;
+    if (alignment == 0) alignment = 1;
+
+    // First fit by address, so repeated calls pack everything towards the start
+    for (auto candidate = m_free.begin(); candidate != m_free.end() && candidate->first < limit; candidate++)
+    {
+        VkDeviceSize freeStart = candidate->first;
+        VkDeviceSize freeEnd = std::min(freeStart + candidate->second, limit);
+        VkDeviceSize start;
+        if (freeEnd - freeStart < size || !fit(freeStart, freeEnd, size, alignment, kind, &start)) continue;
+
+        take(freeStart, freeStart + candidate->second, start, size, kind);
+        *offset = start;
+        return true;
+    }
+
+    return false;
+}
+
+void RangeAllocator::free(VkDeviceSize offset)
+{
+    auto used = m_usedRanges.find(offset);
+    if (used == m_usedRanges.end()) return;
+
+    VkDeviceSize start = offset;
+    VkDeviceSize end = offset + used->second.size;
+    m_used -= used->second.size;
+    m_usedRanges.erase(used);
+
+    // Merge with the free ranges directly after and before us
+    auto next = m_free.lower_bound(end);
+    if (next != m_free.end() && next->first == end)
+    {
+        end += next->second;
+        eraseFree(next);
+    }
+    auto prev = m_free.lower_bound(start);
+    if (prev != m_free.begin())
+    {
+        prev--;
+        if (prev->first + prev->second == start)
+        {
+            start = prev->first;
+            eraseFree(prev);
+        }
+    }
+
+    insertFree(start, end - start);
+}
+
+VkDeviceSize RangeAllocator::getSize() const
+{
+    return m_size;
+}
+
+VkDeviceSize RangeAllocator::getUsed() const
+{
+    return m_used;
+}
+
+bool RangeAllocator::isEmpty() const
+{
+    return m_usedRanges.empty();
+}
+
+VkDeviceSize RangeAllocator::getUsedEnd() const
+{
+    if (m_usedRanges.empty()) return 0;
+    auto last = std::prev(m_usedRanges.end());
+    return last->first + last->second.size;
+}
+
+bool RangeAllocator::findUsedBelow(VkDeviceSize limit, VkDeviceSize* offset, VkDeviceSize* size) const
+{
+    auto used = m_usedRanges.lower_bound(limit);
+    if (used == m_usedRanges.begin()) return false;
+
+    used--;
+    *offset = used->first;
+    *size = used->second.size;
+    return true;
+}
+
+bool RangeAllocator::fit(VkDeviceSize freeStart, VkDeviceSize freeEnd, VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind, VkDeviceSize* start) const
+{
+    *start = alignUp(freeStart, alignment);
+
+    // Free ranges are coalesced so any neighbours are used ranges that touch this one
+    auto next = m_usedRanges.lower_bound(freeStart);
+    if (m_granularity > 1 && next != m_usedRanges.begin())
+    {
+        auto prev = std::prev(next);
+        if (prev->second.kind != kind && onSamePage(prev->first + prev->second.size, *start, m_granularity))
+        {
+            *start = alignUp(*start, m_granularity);
+        }
+    }
+
+    if (*start + size > freeEnd) return false;
+
+    if (m_granularity > 1 && next != m_usedRanges.end())
+    {
+        if (next->second.kind != kind && onSamePage(*start + size, next->first, m_granularity)) return false;
+    }
+    return true;
+}
+
+void RangeAllocator::take(VkDeviceSize freeStart, VkDeviceSize freeEnd, VkDeviceSize start, VkDeviceSize size, ResourceKind kind)
+{
+    eraseFree(m_free.find(freeStart));
+    if (start > freeStart) insertFree(freeStart, start - freeStart);
+    if (start + size < freeEnd) insertFree(start + size, freeEnd - (start + size));
+
+    m_usedRanges[start] = { size, kind };
+    m_used += size;
+}
+
+void RangeAllocator::insertFree(VkDeviceSize offset, VkDeviceSize size)
+{
+    m_freeBySize.insert({ size, offset });
+    m_free[offset] = size;
+}
+
+void RangeAllocator::eraseFree(std::map<VkDeviceSize, VkDeviceSize>::iterator it)
+{
+    m_freeBySize.erase({ it->second, it->first });
+    m_free.erase(it);
+}
@@ -0,0 +1,114 @@
+#include "staging_ring.h"
+
+#include <algorithm>
+
+void StagingRing::init(DeviceAllocator* allocator, VkDevice logical, VkDeviceSize size)
+{
+    m_allocator = allocator;
+    m_logicalDevice = logical;
+    m_size = size;
+
+    m_allocator->createBuffer(
+        m_size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT },
+        &m_buffer,
+        &m_memory,
+        "staging ring"
+    );
+}
+
+void StagingRing::destroy()
+{
+    m_inFlight.clear();
+    m_allocator->destroyBuffer(m_buffer, m_memory);
+}
+
+StagingRegion StagingRing::reserve(VkDeviceSize size, VkDeviceSize alignment, bool allowPartial)
+{
+    // Nothing in flight so we can start over at the front and get the largest contiguous run
+    if (m_used == 0)
+    {
+        m_head = m_tail = 0;
+    }
+
+    // Work out where the region would go first, the ring only changes if the reservation succeeds
+    VkDeviceSize head = m_head;
+    VkDeviceSize wrapPadding = 0;
+    VkDeviceSize start = (m_head + alignment - 1) / alignment * alignment;
+    VkDeviceSize available = 0;
+
+    if (m_used == m_size)
+    {
+        available = 0;
+    }
+    else if (m_head >= m_tail)
+    {
+        // Live data sits in [tail, head) so we can use [head, size) and then [0, tail)
+        VkDeviceSize atEnd = start < m_size ? m_size - start : 0;
+        if (atEnd < size && m_tail > atEnd)
+        {
+            // wrap around and waste the rest of the end of the ring
+            wrapPadding = m_size - m_head;
+            head = 0;
+            start = 0;
+            available = m_tail;
+        }
+        else
+        {
+            available = atEnd;
+        }
+    }
+    else
+    {
+        // Live data wraps around so we can only use [head, tail)
+        available = start < m_tail ? m_tail - start : 0;
+    }
+
+    StagingRegion region =
+    {
+        .buffer = m_buffer,
+        .offset = start,
+        .size = std::min(size, available),
+        .mapped = static_cast<char*>(m_memory.mapped) + start
+    };
+    if (!allowPartial && region.size < size)
+    {
+        region.size = 0;
+    }
+
+    if (region.size > 0)
+    {
+        VkDeviceSize consumed = wrapPadding + (start + region.size) - head;
+        m_used += consumed;
+        m_pending += consumed;
+        m_head = (start + region.size) % m_size;
+    }
+
+    return region;
+}
+
+void StagingRing::retire(uint64_t token)
+{
+    if (m_pending == 0) return;
+
+    m_inFlight.push_back({ m_head, m_pending, token });
+    m_pending = 0;
+}
+
+void StagingRing::reclaim(uint64_t completedToken)
+{
+    // Regions are retired in order so stop at the first one still in use
+    while (!m_inFlight.empty() && m_inFlight.front().token <= completedToken)
+    {
+        InFlight& oldest = m_inFlight.front();
+        m_used -= oldest.bytes;
+        m_tail = oldest.end;
+        m_inFlight.pop_front();
+    }
+}
+
+VkDeviceSize StagingRing::getSize() const
+{
+    return m_size;
+}
@@ -0,0 +1,89 @@
+#include "timeline.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+void Timeline::init(VkDevice logical, const VkAllocationCallbacks* hostAllocator)
+{
+    m_logicalDevice = logical;
+    m_hostAllocator = hostAllocator;
+
+    VkSemaphoreTypeCreateInfo typeInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0
+    };
+    VkSemaphoreCreateInfo semInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo
+    };
+    if (vkCreateSemaphore(m_logicalDevice, &semInfo, m_hostAllocator, &m_semaphore) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create timeline semaphore");
+    }
+
+    m_last = 0;
+    m_completed = 0;
+}
+
+void Timeline::destroy()
+{
+    vkDestroySemaphore(m_logicalDevice, m_semaphore, m_hostAllocator);
+    m_semaphore = VK_NULL_HANDLE;
+}
+
+VkSemaphore Timeline::getSemaphore() const
+{
+    return m_semaphore;
+}
+
+uint64_t Timeline::next()
+{
+    return ++m_last;
+}
+
+uint64_t Timeline::getLast() const
+{
+    return m_last;
+}
+
+uint64_t Timeline::getCompleted()
+{
+    if (m_completed < m_last) readCounter();
+    return m_completed;
+}
+
+bool Timeline::isComplete(uint64_t value)
+{
+    if (value > m_completed) readCounter();
+    return value <= m_completed;
+}
+
+void Timeline::wait(uint64_t value)
+{
+    if (isComplete(value)) return;
+
+    VkSemaphoreWaitInfo waitInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &m_semaphore,
+        .pValues = &value
+    };
+    if (vkWaitSemaphores(m_logicalDevice, &waitInfo, std::numeric_limits<uint64_t>::max()) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to wait on timeline semaphore");
+    }
+    m_completed = std::max(m_completed, value);
+}
+
+void Timeline::readCounter()
+{
+    if (vkGetSemaphoreCounterValue(m_logicalDevice, m_semaphore, &m_completed) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not read timeline semaphore");
+    }
+}
@@ -0,0 +1,417 @@
+#include "transfer_context.h"
+
+#include <cstring>
+#include <stdexcept>
+
+void TransferContext::init(
+    VkDevice logical,
+    const VkAllocationCallbacks* hostAllocator,
+    VkQueue transferQueue,
+    uint32_t transferFamily,
+    VkQueue gfxQueue,
+    uint32_t gfxFamily,
+    Timeline* gfxTimeline,
+    StagingRing* stagingRing
+) {
+    m_logicalDevice = logical;
+    m_hostAllocator = hostAllocator;
+    m_transferQueue = transferQueue;
+    m_transferFamily = transferFamily;
+    m_gfxQueue = gfxQueue;
+    m_gfxFamily = gfxFamily;
+    m_gfxTimeline = gfxTimeline;
+    m_stagingRing = stagingRing;
+
+    m_transferCommandPool = createCommandPool(m_transferFamily);
+    m_gfxCommandPool = createCommandPool(m_gfxFamily);
+    // Without a dedicated queue the copies go to the graphics queue, and so on its timeline
+    if (hasDedicatedQueue()) m_transferTimeline.init(m_logicalDevice, m_hostAllocator);
+    m_copyTimeline = hasDedicatedQueue() ? &m_transferTimeline : m_gfxTimeline;
+    m_submittedValue = 0;
+    m_completedValue = 0;
+}
+
+void TransferContext::destroy()
+{
+    while (!m_inFlight.empty())
+    {
+        poll(true);
+    }
+    if (hasDedicatedQueue()) m_transferTimeline.destroy();
+    m_freeTransferCommands.clear();
+    m_freeGfxCommands.clear();
+
+    // frees all the command buffers too
+    vkDestroyCommandPool(m_logicalDevice, m_gfxCommandPool, m_hostAllocator);
+    vkDestroyCommandPool(m_logicalDevice, m_transferCommandPool, m_hostAllocator);
+}
+
+void TransferContext::upload(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset)
+{
+    VkDeviceSize uploaded = 0;
+    while (uploaded < size)
+    {
+        StagingRegion region = m_stagingRing->reserve(size - uploaded);
+        if (region.size == 0)
+        {
+            // The whole ring is waiting on copies, get ours going and wait for the oldest to finish
+            submit();
+            poll(true);
+            continue;
+        }
+
+        memcpy(region.mapped, static_cast<const char*>(data) + uploaded, static_cast<size_t>(region.size));
+
+        VkBufferCopy bufferCopy =
+        {
+            .srcOffset = region.offset,
+            .dstOffset = dstOffset + uploaded,
+            .size = region.size
+        };
+        copyBuffer(region.buffer, dstBuffer, bufferCopy);
+
+        uploaded += region.size;
+    }
+}
+
+void TransferContext::uploadImage(const void* data, VkDeviceSize size, VkImage dstImage, VkImageLayout dstLayout, VkBufferImageCopy region)
+{
+    if (size > m_stagingRing->getSize())
+    {
+        throw std::runtime_error("Image upload does not fit in the staging ring");
+    }
+
+    // Image copies can't be split on arbitrary byte boundaries so wait until we get one contiguous region
+    StagingRegion staging = m_stagingRing->reserve(size, 16, false);
+    while (staging.size == 0)
+    {
+        submit();
+        poll(true);
+        staging = m_stagingRing->reserve(size, 16, false);
+    }
+
+    memcpy(staging.mapped, data, static_cast<size_t>(size));
+
+    region.bufferOffset = staging.offset;
+    copyBufferToImage(staging.buffer, dstImage, dstLayout, region);
+}
+
+void TransferContext::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, const VkBufferCopy& region)
+{
+    vkCmdCopyBuffer(getCommandBuffer(), srcBuffer, dstBuffer, 1, &region);
+
+    if (hasDedicatedQueue())
+    {
+        m_bufferReleases.push_back({
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = 0,                         // ignored for a release
+            .srcQueueFamilyIndex = m_transferFamily,
+            .dstQueueFamilyIndex = m_gfxFamily,
+            .buffer = dstBuffer,
+            .offset = region.dstOffset,
+            .size = region.size
+        });
+    }
+}
+
+void TransferContext::copyBufferToImage(VkBuffer srcBuffer, VkImage dstImage, VkImageLayout dstLayout, const VkBufferImageCopy& region)
+{
+    vkCmdCopyBufferToImage(getCommandBuffer(), srcBuffer, dstImage, dstLayout, 1, &region);
+
+    if (hasDedicatedQueue())
+    {
+        m_imageReleases.push_back({
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = 0,
+            .oldLayout = dstLayout,                     // layout changes are left to the user of the image
+            .newLayout = dstLayout,
+            .srcQueueFamilyIndex = m_transferFamily,
+            .dstQueueFamilyIndex = m_gfxFamily,
+            .image = dstImage,
+            .subresourceRange =
+            {
+                .aspectMask = region.imageSubresource.aspectMask,
+                .baseMipLevel = region.imageSubresource.mipLevel,
+                .levelCount = 1,
+                .baseArrayLayer = region.imageSubresource.baseArrayLayer,
+                .layerCount = region.imageSubresource.layerCount
+            }
+        });
+    }
+}
+
+VkCommandBuffer TransferContext::getCommandBuffer()
+{
+    if (m_recording != VK_NULL_HANDLE) return m_recording;
+
+    m_recording = getFreeCommandBuffer(m_transferCommandPool, m_freeTransferCommands);
+    return m_recording;
+}
+
+TransferToken TransferContext::submit()
+{
+    // Nothing recorded so there is nothing new to wait for
+    if (m_recording == VK_NULL_HANDLE)
+    {
+        m_stagingRing->retire(m_submittedValue);
+        return { m_submittedValue };
+    }
+
+    Submission submission =
+    {
+        .value = m_copyTimeline->next(),
+        .transferCommands = m_recording
+    };
+
+    if (hasDedicatedQueue())
+    {
+        // Release everything we wrote to the graphics family, the matching acquire happens in submitAcquire
+        vkCmdPipelineBarrier(
+            m_recording,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0,
+            0, nullptr,
+            static_cast<uint32_t>(m_bufferReleases.size()), m_bufferReleases.data(),
+            static_cast<uint32_t>(m_imageReleases.size()), m_imageReleases.data()
+        );
+
+        for (auto barrier : m_bufferReleases)
+        {
+            barrier.srcAccessMask = 0;                  // ignored for an acquire
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            submission.bufferAcquires.push_back(barrier);
+        }
+        for (auto barrier : m_imageReleases)
+        {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            submission.imageAcquires.push_back(barrier);
+        }
+        m_bufferReleases.clear();
+        m_imageReleases.clear();
+
+        submission.needsAcquire = !submission.bufferAcquires.empty() || !submission.imageAcquires.empty();
+    }
+    else
+    {
+        // Same queue as the draws so just make the copies visible to everything submitted after us
+        VkMemoryBarrier barrier =
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT
+        };
+        vkCmdPipelineBarrier(
+            m_recording,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            0,
+            1, &barrier,
+            0, nullptr,
+            0, nullptr
+        );
+    }
+
+    if (vkEndCommandBuffer(m_recording) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to end recording transfer command buffer");
+    }
+
+    VkSemaphore timeline = m_copyTimeline->getSemaphore();
+    VkTimelineSemaphoreSubmitInfo timelineInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &submission.value
+    };
+    VkSubmitInfo submitInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfo,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &m_recording,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &timeline
+    };
+    if (vkQueueSubmit(m_transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to submit transfer command buffer");
+    }
+
+    m_inFlight.push_back(submission);
+    m_submittedValue = submission.value;
+    m_stagingRing->retire(submission.value);
+    m_recording = VK_NULL_HANDLE;
+
+    return { submission.value };
+}
+
+bool TransferContext::isComplete(TransferToken token)
+{
+    poll(false);
+    return token.value <= m_completedValue;
+}
+
+void TransferContext::wait(TransferToken token)
+{
+    while (token.value > m_completedValue && !m_inFlight.empty())
+    {
+        poll(true);
+    }
+}
+
+bool TransferContext::isIdle() const
+{
+    return m_recording == VK_NULL_HANDLE && m_inFlight.empty();
+}
+
+void TransferContext::update()
+{
+    poll(false);
+}
+
+bool TransferContext::hasDedicatedQueue() const
+{
+    return m_transferFamily != m_gfxFamily;
+}
+
+VkCommandPool TransferContext::createCommandPool(uint32_t queueFamily)
+{
+    VkCommandPoolCreateInfo poolInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, // command buffers are recycled one at a time
+        .queueFamilyIndex = queueFamily
+    };
+
+    VkCommandPool pool;
+    if (vkCreateCommandPool(m_logicalDevice, &poolInfo, m_hostAllocator, &pool) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create transfer command pool");
+    }
+    return pool;
+}
+
+VkCommandBuffer TransferContext::getFreeCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList)
+{
+    VkCommandBuffer commandBuffer;
+    if (!freeList.empty())
+    {
+        commandBuffer = freeList.back();
+        freeList.pop_back();
+    }
+    else
+    {
+        VkCommandBufferAllocateInfo allocInfo =
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1
+        };
+        if (vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Could not allocate transfer command buffer");
+        }
+    }
+
+    VkCommandBufferBeginInfo beginInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to start recording transfer command buffer");
+    }
+
+    return commandBuffer;
+}
+
+void TransferContext::submitAcquire(Submission& submission)
+{
+    submission.acquireCommands = getFreeCommandBuffer(m_gfxCommandPool, m_freeGfxCommands);
+
+    vkCmdPipelineBarrier(
+        submission.acquireCommands,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0,
+        0, nullptr,
+        static_cast<uint32_t>(submission.bufferAcquires.size()), submission.bufferAcquires.data(),
+        static_cast<uint32_t>(submission.imageAcquires.size()), submission.imageAcquires.data()
+    );
+
+    if (vkEndCommandBuffer(submission.acquireCommands) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to end recording acquire command buffer");
+    }
+
+    // We only get here once the copies are done so this wait is already satisfied and doesn't hold up the graphics queue
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSemaphore transferTimeline = m_transferTimeline.getSemaphore();
+    VkSemaphore gfxTimeline = m_gfxTimeline->getSemaphore();
+    submission.acquireValue = m_gfxTimeline->next();
+    VkTimelineSemaphoreSubmitInfo timelineInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = 1,
+        .pWaitSemaphoreValues = &submission.value,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &submission.acquireValue
+    };
+    VkSubmitInfo submitInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfo,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &transferTimeline,
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &submission.acquireCommands,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &gfxTimeline
+    };
+    if (vkQueueSubmit(m_gfxQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to submit acquire command buffer");
+    }
+}
+
+void TransferContext::poll(bool wait)
+{
+    if (wait && !m_inFlight.empty())
+    {
+        // An acquire that hasn't been submitted yet is waiting on the copies, the next poll submits it
+        Submission& oldest = m_inFlight.front();
+        if (oldest.acquireCommands != VK_NULL_HANDLE) m_gfxTimeline->wait(oldest.acquireValue);
+        else m_copyTimeline->wait(oldest.value);
+    }
+
+    // Transfers finish in order, hand each finished batch over to the graphics queue
+    uint64_t transferredValue = m_copyTimeline->getCompleted();
+    for (auto& submission : m_inFlight)
+    {
+        if (submission.value > transferredValue) break;
+        if (submission.needsAcquire && submission.acquireCommands == VK_NULL_HANDLE) submitAcquire(submission);
+    }
+
+    // The staging data is free as soon as the copies are done, no need to wait for the acquire
+    m_stagingRing->reclaim(transferredValue);
+
+    while (!m_inFlight.empty())
+    {
+        Submission& oldest = m_inFlight.front();
+        if (oldest.value > transferredValue) break;
+        if (oldest.needsAcquire && !m_gfxTimeline->isComplete(oldest.acquireValue)) break;
+
+        m_freeTransferCommands.push_back(oldest.transferCommands);
+        if (oldest.needsAcquire) m_freeGfxCommands.push_back(oldest.acquireCommands);
+
+        m_completedValue = oldest.value;
+        m_inFlight.pop_front();
+    }
+}
\ No newline at end of file
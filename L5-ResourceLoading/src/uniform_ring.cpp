@@ -0,0 +1,48 @@
+#include "uniform_ring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void UniformRing::init(DeviceAllocator* allocator, VkDeviceSize minAlignment, uint32_t frameCount, VkDeviceSize frameSize)
+{
+    m_alignment = std::max<VkDeviceSize>(minAlignment, 1);
+    m_frameSize = frameSize;
+    m_buffer.init(allocator, frameCount, frameSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, "uniform ring");
+    m_mapped = static_cast<char*>(m_buffer.getMapped(0));
+}
+
+void UniformRing::destroy()
+{
+    m_buffer.destroy();
+}
+
+void UniformRing::beginFrame(uint32_t frameIndex)
+{
+    // Segments start at a multiple of any uniform offset alignment
+    m_frameStart = m_buffer.getFrame(frameIndex).offset;
+    m_cursor = m_frameStart;
+}
+
+uint32_t UniformRing::push(const void* data, VkDeviceSize size)
+{
+    VkDeviceSize offset = alignUp(m_cursor, m_alignment);
+    if (offset + size > m_frameStart + m_frameSize)
+    {
+        throw std::runtime_error("Uniform ring segment is full");
+    }
+
+    memcpy(m_mapped + offset, data, size);
+    m_cursor = offset + size;
+    return static_cast<uint32_t>(offset);
+}
+
+VkBuffer UniformRing::getBuffer() const
+{
+    return m_buffer.getBuffer();
+}
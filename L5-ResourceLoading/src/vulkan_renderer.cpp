@@ -1,14 +1,55 @@
 #include "vulkan_renderer.h"
 
 #include <array>
+#include <chrono>
 #include <algorithm>
 #include <iostream>
 #include <stdlib.h>
 #include <set>
 
-int VulkanRenderer::init(GLFWwindow* wnd)
+#include <glm/gtc/matrix_transform.hpp>
+
+// What each present policy asks for
+struct PresentSettings
+{
+    std::vector<VkPresentModeKHR> modes;    // most preferred first, FIFO if none are supported
+    uint32_t extraImages;                   // on top of the surface's minImageCount
+    uint32_t framesInFlight;
+};
+
+static const PresentSettings& getPresentSettings(PresentPolicy policy)
+{
+    static const PresentSettings lowLatency = { { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR }, 0, 1 };
+    static const PresentSettings smooth = { { VK_PRESENT_MODE_FIFO_RELAXED_KHR }, 1, 2 };
+    static const PresentSettings powerSaving = { { VK_PRESENT_MODE_FIFO_KHR }, 0, 1 };
+
+    switch (policy)
+    {
+        case PresentPolicy::LowLatency: return lowLatency;
+        case PresentPolicy::PowerSaving: return powerSaving;
+        default: return smooth;
+    }
+}
+
+// Enough frame slots for any policy to be switched to later
+static uint32_t getMaxPolicyFramesInFlight()
+{
+    uint32_t frames = 1;
+    for (auto policy : { PresentPolicy::LowLatency, PresentPolicy::Smooth, PresentPolicy::PowerSaving })
+    {
+        frames = std::max(frames, getPresentSettings(policy).framesInFlight);
+    }
+    return frames;
+}
+
+int VulkanRenderer::init(GLFWwindow* wnd, const RendererSettings& settings)
 {
     m_window = wnd;
+    m_settings = settings;
+    m_presentPolicy = settings.presentPolicy;
+    m_frameSlots = settings.framesInFlight > 0 ? settings.framesInFlight : getMaxPolicyFramesInFlight();
+    m_framesInFlight = settings.framesInFlight > 0 ? settings.framesInFlight : getPresentSettings(m_presentPolicy).framesInFlight;
+    m_hostAllocator.init();
 
     try
     {
@@ -17,24 +58,20 @@ int VulkanRenderer::init(GLFWwindow* wnd)
         getPhysicalDevice();
         createLogicalDevice();
         createSwapChain();
+        createDescriptorSetLayout();
+        createDescriptorSet();
         createGraphicsPipeline();
         createFramebuffers();
+        m_workers.init();
         createCommandPool();
 
         // Vertex Data
-        std::vector<Vertex> meshVertices1 =
-        {
-            {{-0.9f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}}, // top left     0
-            {{-0.1f, -0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}},  // top right    1
-            {{-0.1f, 0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}},   // bottom right 2
-            {{-0.9f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}},  // bottom left  3
-        };
-        std::vector<Vertex> meshVertices2 =
+        std::vector<Vertex> meshVertices =
         {
-            {{0.1f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}}, // top left     0
-            {{0.9f, -0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}},  // top right    1
-            {{0.9f, 0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}},   // bottom right 2
-            {{0.1f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}},  // bottom left  3
+            {{-0.4f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}}, // top left     0
+            {{0.4f, -0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}},  // top right    1
+            {{0.4f, 0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}},   // bottom right 2
+            {{-0.4f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}},  // bottom left  3
         };
         // Index Data
         std::vector<uint32_t> meshIndices =
@@ -42,14 +79,30 @@ int VulkanRenderer::init(GLFWwindow* wnd)
             0, 1, 2,
             0, 2, 3
         };
+        auto uploadStart = std::chrono::steady_clock::now();
         m_meshes =
         {
-            Mesh(m_device.physical, m_device.logical, m_gfxQueue, m_gfxCommandPool, &meshVertices1, &meshIndices),
-            Mesh(m_device.physical, m_device.logical, m_gfxQueue, m_gfxCommandPool, &meshVertices2, &meshIndices),
+            Mesh(&m_geometry, &m_transfer, &meshVertices, &meshIndices),
         };
+        // All staged mesh uploads go to the GPU in one submit (on the transfer queue if there is one)
+        // Nothing else to draw yet so wait for it, streamed meshes would check the token with isComplete instead
+        // (draw moves uploads along every frame)
+        m_transfer.wait(m_transfer.submit());
+        std::chrono::duration<double, std::milli> uploadTime = std::chrono::steady_clock::now() - uploadStart;
+        printUploadStats(uploadTime.count());
+        printMeshMemory();
+
+        for (size_t m = 0; m < m_meshes.size(); m++)
+        {
+            addMeshDraw(m_meshes[m]);
+            writeDrawData(m);
+        }
+
+        // The same quad twice, side by side
+        addInstance(0, glm::translate(glm::mat4(1.0f), glm::vec3(-0.5f, 0.0f, 0.0f)), glm::vec4(1.0f));
+        addInstance(0, glm::translate(glm::mat4(1.0f), glm::vec3(0.5f, 0.0f, 0.0f)), glm::vec4(1.0f));
 
         allocateCommandBuffers();
-        recordCommands();
         createSynchronization();
     }
     catch(const std::runtime_error& e)
@@ -64,22 +117,30 @@ int VulkanRenderer::init(GLFWwindow* wnd)
 void VulkanRenderer::draw()
 {
     // WAIT ON PREVIOUS FRAMES TO COMPLETE
-    vkWaitForFences(                            // this fence will be signaled when a queue completes
-        m_device.logical,
-        1,
-        &(m_drawFences[m_currentFrame]),
-        VK_TRUE,
-        std::numeric_limits<uint64_t>::max()
-    );
-    vkResetFences(                              // after passing through the fence we need to close to fence
-        m_device.logical,
-        1,
-        &(m_drawFences[m_currentFrame])
-    );
+    // At most m_framesInFlight frames ahead of the GPU, and the frame that last used this slot has to be done
+    // (not necessarily m_framesInFlight frames ago if the policy changed since)
+    while (m_recentFrames.size() >= m_framesInFlight)
+    {
+        m_frameTimeline.wait(m_recentFrames.front());
+        m_recentFrames.pop_front();
+    }
+    m_frameTimeline.wait(m_slotFrames[m_currentFrame]);
+    releaseRetiredSwapchains();
+
+    // Uploads that finished copying are acquired by the graphics queue ahead of this frame's draws
+    // This is the frame's only transfer call that can submit, it has to come before the frame takes its value
+    m_transfer.update();
+
+    // Resized (or the last present said so), swap in a new swapchain before acquiring from the old one
+    if (m_swapchainOutdated)
+    {
+        recreateSwapChain();
+        if (m_swapchainOutdated) return;    // closed while minimised, nothing to draw to
+    }
 
     // GET NEXT IMAGE
     uint32_t nextImage;
-    vkAcquireNextImageKHR(
+    VkResult result = vkAcquireNextImageKHR(
         m_device.logical,                       // this needs to be true to prevent possible synchronization bugs
         m_swapchain,
         std::numeric_limits<uint64_t>::max(),   // block until image is available
@@ -87,73 +148,185 @@ void VulkanRenderer::draw()
         VK_NULL_HANDLE,
         &nextImage
     );
+    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        // No image and the semaphore wasn't signalled, try again with a new swapchain next frame
+        m_swapchainOutdated = true;
+        return;
+    }
+    else if (result == VK_SUBOPTIMAL_KHR)
+    {
+        // Still got an image we can draw and present, replace the swapchain afterwards
+        m_swapchainOutdated = true;
+    }
+    else if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to acquire swapchain image");
+    }
+    // The value is only taken once we know the frame will be submitted, nothing else submits to the graphics
+    // queue before it does (the transfer context was updated above and isn't called again this frame)
+    uint64_t frameValue = m_frameTimeline.next();
+    m_slotFrames[m_currentFrame] = frameValue;
+
+    // Anything retired by a frame the GPU has got past can be reused, which may be more than we waited for
+    m_geometry.beginFrame(frameValue, m_frameTimeline.getCompleted());
+
+    // The image can still be drawn to by a frame from another slot (more frames in flight than images,
+    // or images coming back out of order), don't render to it until that frame is done
+    m_frameTimeline.wait(m_imageFrames[nextImage]);
+    m_imageFrames[nextImage] = frameValue;
+
+    // The wait also covers everything recorded for this frame slot last time, so all of it can go at once
+    FrameCommands& frame = m_frameCommands[m_currentFrame];
+    vkResetCommandPool(m_device.logical, frame.pool, 0);
+    for (auto pool : frame.slicePools)
+    {
+        vkResetCommandPool(m_device.logical, pool, 0);
+    }
+
+    // Any defragmentation copies go in front of the draws in the same submit
+    // The pool can only be compacted once no staged upload is still on its way into it
+    bool defragmenting = m_transfer.isIdle() && recordDefragment(frame.defrag);
+    if (defragmenting) updateMovedDraws();
+    if (m_instancesChanged) packInstances();
+    frame.instances = m_instanceBuffer.prepareFrame(m_currentFrame);
+    m_drawDataBuffer.flush(m_currentFrame, m_drawData.data(), m_drawData.size() * sizeof(DrawData));
+    frame.dynamicOffsets[1] = static_cast<uint32_t>(m_drawDataBuffer.getFrame(m_currentFrame).offset);
+
+    // This frame's segment of the ring is free again, the constants for the whole frame are one write
+    m_uniforms.beginFrame(m_currentFrame);
+    frame.dynamicOffsets[0] = m_uniforms.push(FrameUniforms{ m_viewProj });
+    recordCommands(frame, nextImage);
+
+    // This frame's draws use the new offsets, the moved-from ranges are free once the older frames finish
+    m_geometry.releaseMoves(m_geometry.getVersion());
+    std::array<VkCommandBuffer, 2> frameCommands = { frame.defrag, frame.primary };
 
     // SUBMIT COMMAND BUFFER TO COMMAND QUEUE
     VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};   // we can run everything up to the point where we start writing out colors out before the framebuffer is ready
+    std::array<VkSemaphore, 2> signalSemaphores = { m_renderFinished[nextImage], m_frameTimeline.getSemaphore() };
+    std::array<uint64_t, 2> signalValues = { 0, frameValue };   // binary semaphores ignore their value
+    VkTimelineSemaphoreSubmitInfo timelineInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size()),
+        .pSignalSemaphoreValues = signalValues.data()
+    };
     VkSubmitInfo submitInfo =
     {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfo,
         .waitSemaphoreCount = 1,
         .pWaitSemaphores = &m_imageAvailable[m_currentFrame],
         .pWaitDstStageMask = waitStages,       // signifies which stages the semaphore list corresponds to
-        .commandBufferCount = 1,
-        .pCommandBuffers = &m_commandBuffers[nextImage],
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &m_renderFinished[m_currentFrame]
+        .commandBufferCount = defragmenting ? 2u : 1u,
+        .pCommandBuffers = defragmenting ? &frameCommands[0] : &frameCommands[1],
+        .signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size()),
+        .pSignalSemaphores = signalSemaphores.data()
     };
-    if (vkQueueSubmit(m_gfxQueue, 1, &submitInfo, m_drawFences[m_currentFrame]) != VK_SUCCESS) // this will signal our fence when it completes
+    if (vkQueueSubmit(m_gfxQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) // the timeline reaches frameValue when it completes
     {
         throw std::runtime_error("Failed to submit command buffer to queue");
     }
+    m_recentFrames.push_back(frameValue);
+    for (auto& retired : m_retiredSwapchains)
+    {
+        if (retired.framesLeft > 0 && --retired.framesLeft == 0) retired.frame = frameValue;
+    }
 
     // PRESENT RENDERED IMAGE TO SCREEN
+    // On its own queue so it doesn't hold up the next frame's submit, renderFinished orders it after the
+    // draws across queues, and the images are shared CONCURRENT between the families when they differ
+    // so there is no ownership to hand over
     VkPresentInfoKHR presentInfo =
     {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &m_renderFinished[m_currentFrame],
+        .pWaitSemaphores = &m_renderFinished[nextImage],
         .swapchainCount = 1,
         .pSwapchains = &m_swapchain,
         .pImageIndices = &nextImage
     };
-    if (vkQueuePresentKHR(m_gfxQueue, &presentInfo) != VK_SUCCESS)
+    result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+    {
+        m_swapchainOutdated = true;
+    }
+    else if (result != VK_SUCCESS)
     {
         throw std::runtime_error("Failed to present swapchain image");
     }
 
-    m_currentFrame = (m_currentFrame + 1) % MAX_FRAME_DRAWS;
+    m_currentFrame = (m_currentFrame + 1) % m_framesInFlight;
 }
 
 void VulkanRenderer::destroy()
 {
     vkDeviceWaitIdle(m_device.logical);
 
+    for (auto& retired : m_retiredSwapchains)
+    {
+        destroyRetiredSwapchain(retired);
+    }
+    m_retiredSwapchains.clear();
+
     for (auto& mesh : m_meshes)
     {
+        removeMeshDraw(mesh);
         mesh.destroyVertexBuffer();
     }
-    for (size_t i = 0; i < MAX_FRAME_DRAWS; i++)
+    if (m_gpuCulling) m_culler.destroy();
+    m_drawList.destroy();
+    m_instanceBuffer.destroy();
+    m_uniforms.destroy();
+    m_drawDataBuffer.destroy();
+    // Every mesh is gone by now so anything still in the pool was never freed
+    if (m_geometry.getLiveCount() > 0)
+    {
+        std::cout << "Leaked " << m_geometry.getLiveCount() << " geometry pool ranges" << std::endl;
+    }
+    m_geometry.destroy();
+    m_transfer.destroy();
+    m_stagingRing.destroy();
+    printMemoryReport();    // anything still alive here is a leak
+    printEncoderStats();
+    m_allocator.destroy();
+    m_frameTimeline.destroy();
+    for (auto semaphore : m_renderFinished)
+    {
+        vkDestroySemaphore(m_device.logical, semaphore, m_hostAllocator.getCallbacks());
+    }
+    for (auto semaphore : m_imageAvailable)
     {
-        vkDestroyFence(m_device.logical, m_drawFences[i], nullptr);
-        vkDestroySemaphore(m_device.logical, m_renderFinished[i], nullptr);
-        vkDestroySemaphore(m_device.logical, m_imageAvailable[i], nullptr);
+        vkDestroySemaphore(m_device.logical, semaphore, m_hostAllocator.getCallbacks());
     }
-    vkDestroyCommandPool(m_device.logical, m_gfxCommandPool, nullptr);
+    for (auto& frame : m_frameCommands)
+    {
+        vkDestroyCommandPool(m_device.logical, frame.pool, m_hostAllocator.getCallbacks());
+        for (auto pool : frame.slicePools)
+        {
+            vkDestroyCommandPool(m_device.logical, pool, m_hostAllocator.getCallbacks());
+        }
+    }
+    m_workers.destroy();
     for (auto& framebuffer : m_framebuffers)
     {
-        vkDestroyFramebuffer(m_device.logical, framebuffer, nullptr);
+        vkDestroyFramebuffer(m_device.logical, framebuffer, m_hostAllocator.getCallbacks());
     }
-    vkDestroyPipeline(m_device.logical, m_gfxpipeline, nullptr);
-    vkDestroyPipelineLayout(m_device.logical, m_pipelineLayout, nullptr),
-    vkDestroyRenderPass(m_device.logical, m_renderpass, nullptr);
+    destroyGraphicsPipeline();
+    vkDestroyDescriptorPool(m_device.logical, m_descriptorPool, m_hostAllocator.getCallbacks());
+    vkDestroyDescriptorSetLayout(m_device.logical, m_frameSetLayout, m_hostAllocator.getCallbacks());
     for (auto image : m_swapchainImages)
     {
-        vkDestroyImageView(m_device.logical, image.imageView, nullptr);
+        vkDestroyImageView(m_device.logical, image.imageView, m_hostAllocator.getCallbacks());
     }
-    vkDestroySwapchainKHR(m_device.logical, m_swapchain, nullptr);
-    vkDestroyDevice(m_device.logical, nullptr);
-    vkDestroySurfaceKHR(m_instance, m_surface.surface, nullptr);
-    vkDestroyInstance(m_instance, nullptr);
+    vkDestroySwapchainKHR(m_device.logical, m_swapchain, m_hostAllocator.getCallbacks());
+    vkDestroyDevice(m_device.logical, m_hostAllocator.getCallbacks());
+    vkDestroySurfaceKHR(m_instance, m_surface.surface, m_hostAllocator.getCallbacks());
+    vkDestroyInstance(m_instance, m_hostAllocator.getCallbacks());
+
+    printHostAllocationStats();
+    m_hostAllocator.destroy();
 }
 
 void VulkanRenderer::createInstance()
@@ -208,7 +381,7 @@ void VulkanRenderer::createInstance()
     #endif
 
     // create instance
-    VkResult result = vkCreateInstance(&createInfo, nullptr, &m_instance);
+    VkResult result = vkCreateInstance(&createInfo, m_hostAllocator.getCallbacks(), &m_instance);
     if (result != VK_SUCCESS)
     {
         throw std::runtime_error("Failed to create Vulkan Instance");
@@ -217,10 +390,20 @@ void VulkanRenderer::createInstance()
 
 void VulkanRenderer::createSurface()
 {
-    if (glfwCreateWindowSurface(m_instance, m_window, nullptr, &m_surface.surface) != VK_SUCCESS)
+    if (glfwCreateWindowSurface(m_instance, m_window, m_hostAllocator.getCallbacks(), &m_surface.surface) != VK_SUCCESS)
     {
         throw std::runtime_error("Failed to create GLFW surface");
     };
+
+    // Present doesn't always report a resize (e.g. Wayland never goes out of date) so listen for it too
+    glfwSetWindowUserPointer(m_window, this);
+    glfwSetFramebufferSizeCallback(m_window, framebufferResizeCallback);
+}
+
+void VulkanRenderer::framebufferResizeCallback(GLFWwindow* window, int width, int height)
+{
+    VulkanRenderer* renderer = static_cast<VulkanRenderer*>(glfwGetWindowUserPointer(window));
+    renderer->m_swapchainOutdated = true;
 }
 
 bool VulkanRenderer::checkInstanceExtensionSupport(const std::vector<const char*>& tocheck) const
@@ -295,13 +478,31 @@ bool VulkanRenderer::checkPhysicalDevice(const VkPhysicalDevice& device)
     deviceSuitable &= getQueueFamilies(device).isValid();
     deviceSuitable &= checkDeviceExtensionSupport(device);
 
+    // Frames and uploads are synchronised with timeline semaphores
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(device, &props);
+    VkPhysicalDeviceVulkan12Features vulkan12Features =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+    };
+    if (props.apiVersion >= VK_API_VERSION_1_2)
+    {
+        VkPhysicalDeviceFeatures2 features2 =
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &vulkan12Features
+        };
+        vkGetPhysicalDeviceFeatures2(device, &features2);
+    }
+    deviceSuitable &= vulkan12Features.timelineSemaphore == VK_TRUE;
+
     auto swapchainDetails = getSwapchainDetails(device);
     deviceSuitable &= (!swapchainDetails.formats.empty()) && (!swapchainDetails.presentModes.empty());
 
     return deviceSuitable;
 }
 
-bool VulkanRenderer::checkDeviceExtensionSupport(const VkPhysicalDevice& dev)
+bool VulkanRenderer::checkDeviceExtensionSupport(const VkPhysicalDevice& dev, const std::vector<const char*>& extensions)
 {
     uint32_t extCount{0};
     vkEnumerateDeviceExtensionProperties(dev, nullptr, &extCount, nullptr);
@@ -311,7 +512,7 @@ bool VulkanRenderer::checkDeviceExtensionSupport(const VkPhysicalDevice& dev)
     std::vector<VkExtensionProperties> extensionProperties{extCount};
     vkEnumerateDeviceExtensionProperties(dev, nullptr, &extCount, extensionProperties.data());
 
-    for (const auto& ext : DEVICE_EXTENSIONS)
+    for (const auto& ext : extensions)
     {
         bool has_extension = false;
         for (const auto& vkext : extensionProperties)
@@ -345,19 +546,30 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(const VkPhysicalDevice& dev)
     int i = 0;
     for (const auto& queueFamily : queueFamilyList)
     {
-        if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        // Keep looking for a transfer family after we've found the ones we need
+        if (!indicies.isValid())
         {
-            indicies.graphicsFamily = i;
-        }
+            if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+            {
+                indicies.graphicsFamily = i;
+            }
 
-        VkBool32 presentationSupport{VK_FALSE};
-        vkGetPhysicalDeviceSurfaceSupportKHR(dev, i, m_surface.surface, &presentationSupport);
-        if (queueFamily.queueCount > 0 && presentationSupport)
-        {
-            indicies.presentationFamily = i;
+            VkBool32 presentationSupport{VK_FALSE};
+            vkGetPhysicalDeviceSurfaceSupportKHR(dev, i, m_surface.surface, &presentationSupport);
+            if (queueFamily.queueCount > 0 && presentationSupport)
+            {
+                indicies.presentationFamily = i;
+            }
         }
 
-        if (indicies.isValid()) break;
+        // A family that can transfer but not draw or compute is usually a DMA engine that runs alongside the graphics queue
+        if (
+            indicies.transferFamily < 0 && queueFamily.queueCount > 0 &&
+            (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+        ) {
+            indicies.transferFamily = i;
+        }
 
         i++;
     }
@@ -370,35 +582,95 @@ void VulkanRenderer::createLogicalDevice()
     QueueFamilyIndices indices = getQueueFamilies(m_device.physical);
 
     std::vector<VkDeviceQueueCreateInfo> queueInfos;
-    // If the gfx and presentation family are the same then we only end up with one queue index
-    std::set<int> queueFamilyIndices = { indices.graphicsFamily, indices.presentationFamily };
+    // If the gfx, presentation and transfer family are the same then we only end up with one queue index
+    std::set<int> queueFamilyIndices = { indices.graphicsFamily, indices.presentationFamily, indices.getTransferFamily() };
+
+    // Presenting from the graphics queue would serialise it with the frame submits (and with any other
+    // thread submitting graphics work), so if presentation shares the graphics family it gets a second
+    // queue of that family where there is one
+    uint32_t queueFamilyCount{0};
+    vkGetPhysicalDeviceQueueFamilyProperties(m_device.physical, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilyList{queueFamilyCount};
+    vkGetPhysicalDeviceQueueFamilyProperties(m_device.physical, &queueFamilyCount, queueFamilyList.data());
+    uint32_t presentQueueIndex = 0;
+    if (indices.presentationFamily == indices.graphicsFamily && queueFamilyList[indices.graphicsFamily].queueCount > 1)
+    {
+        presentQueueIndex = 1;
+    }
 
-    float priority{1.0f};
+    std::array<float, 2> priorities = { 1.0f, 1.0f };
     for (auto index : queueFamilyIndices)
     {
         VkDeviceQueueCreateInfo queueInfo = {
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
             .queueFamilyIndex = static_cast<uint32_t>(index),
-            .queueCount = 1,
-            .pQueuePriorities = &priority // pQueuePriorities takes an array with length = queueCount
+            .queueCount = index == indices.presentationFamily ? presentQueueIndex + 1 : 1,
+            .pQueuePriorities = priorities.data() // pQueuePriorities takes an array with length = queueCount
         };
 
         queueInfos.push_back(queueInfo);
     }
 
+    // Turn on whichever optional extensions the device has
+    std::vector<const char*> extensions = DEVICE_EXTENSIONS;
+    bool memoryBudget = checkDeviceExtensionSupport(m_device.physical, { VK_EXT_MEMORY_BUDGET_EXTENSION_NAME });
+    if (memoryBudget) extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
     // Get device features
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(m_device.physical, &supportedFeatures);
     VkPhysicalDeviceFeatures devFeatures = {};
 
+    // Without multi draw every indirect draw is one command, still no CPU work per mesh to record it though
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_device.physical, &properties);
+    devFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    // Indirect draws of instanced meshes start at firstInstance, if that has to be 0 draw directly instead
+    devFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+    if (supportedFeatures.drawIndirectFirstInstance != VK_TRUE) m_indirectDraws = false;
+    m_multiDrawIndirect = supportedFeatures.multiDrawIndirect == VK_TRUE;
+    if (m_multiDrawIndirect)
+    {
+        m_maxDrawIndirectCount = properties.limits.maxDrawIndirectCount;
+    }
+
+    // Timeline semaphores are required (checked by checkPhysicalDevice)
+    // GPU culling needs the draw count to come from a buffer (core in 1.2 but still optional),
+    // whether every command fits in one call is checked against the scene each frame. Vertex pulling needs buffer device addresses
+    VkPhysicalDeviceVulkan12Features vulkan12Features =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+    };
+    if (properties.apiVersion >= VK_API_VERSION_1_2)
+    {
+        VkPhysicalDeviceFeatures2 supportedFeatures2 =
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &vulkan12Features
+        };
+        vkGetPhysicalDeviceFeatures2(m_device.physical, &supportedFeatures2);
+    }
+    m_gpuCulling = vulkan12Features.drawIndirectCount == VK_TRUE;
+    m_vertexPulling = m_settings.vertexPulling && vulkan12Features.bufferDeviceAddress == VK_TRUE;
+    VkPhysicalDeviceVulkan12Features enabled12Features =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .drawIndirectCount = m_gpuCulling ? VK_TRUE : VK_FALSE,
+        .timelineSemaphore = VK_TRUE,
+        .bufferDeviceAddress = m_vertexPulling ? VK_TRUE : VK_FALSE
+    };
+
     VkDeviceCreateInfo devInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &enabled12Features,
         .queueCreateInfoCount = static_cast<uint32_t>(queueInfos.size()),
         .pQueueCreateInfos = queueInfos.data(),
-        .enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size()), // the device doesn't care about glfw extensions so this is just 0
-        .ppEnabledExtensionNames = DEVICE_EXTENSIONS.data(),
+        .enabledExtensionCount = static_cast<uint32_t>(extensions.size()), // the device doesn't care about glfw extensions so this is just 0
+        .ppEnabledExtensionNames = extensions.data(),
         .pEnabledFeatures = &devFeatures
     };
 
-    VkResult result = vkCreateDevice(m_device.physical, &devInfo, nullptr, &m_device.logical);
+    VkResult result = vkCreateDevice(m_device.physical, &devInfo, m_hostAllocator.getCallbacks(), &m_device.logical);
     if (result != VK_SUCCESS)
     {
         throw std::runtime_error("Could not create Vulkan Logic Device");
@@ -407,7 +679,40 @@ void VulkanRenderer::createLogicalDevice()
     // Queues are created when the logical device is created
     // So we just neet to fetch them
     vkGetDeviceQueue(m_device.logical, indices.graphicsFamily, 0, &m_gfxQueue);
-    vkGetDeviceQueue(m_device.logical, indices.presentationFamily, 0, &m_presentQueue);
+    vkGetDeviceQueue(m_device.logical, indices.presentationFamily, presentQueueIndex, &m_presentQueue);
+    vkGetDeviceQueue(m_device.logical, indices.getTransferFamily(), 0, &m_transferQueue);
+
+    // Memory properties never change for a device so the allocator caches them once here
+    m_allocator.init(m_device.physical, m_device.logical, m_hostAllocator.getCallbacks(), memoryBudget, m_vertexPulling);
+    m_stagingRing.init(&m_allocator, m_device.logical);
+    // Before anything can submit to the graphics queue, the transfer context's acquires signal it too
+    m_frameTimeline.init(m_device.logical, m_hostAllocator.getCallbacks());
+    m_transfer.init(
+        m_device.logical,
+        m_hostAllocator.getCallbacks(),
+        m_transferQueue,
+        static_cast<uint32_t>(indices.getTransferFamily()),
+        m_gfxQueue,
+        static_cast<uint32_t>(indices.graphicsFamily),
+        &m_frameTimeline,
+        &m_stagingRing
+    );
+    m_geometry.init(&m_allocator);
+    if (m_settings.stagedUploads) m_geometry.setDirectWrite(false);
+    m_drawList.init(&m_allocator, m_frameSlots, m_settings.drawCapacity);
+    m_instanceBuffer.init(&m_allocator, m_frameSlots, m_settings.instanceCapacity);
+    m_uniforms.init(&m_allocator, properties.limits.minUniformBufferOffsetAlignment, m_frameSlots);
+    m_drawDataBuffer.init(
+        &m_allocator,
+        m_frameSlots,
+        VkDeviceSize(m_settings.drawCapacity) * sizeof(DrawData),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        "draw data"
+    );
+    if (m_gpuCulling)
+    {
+        m_culler.init(m_device.logical, m_hostAllocator.getCallbacks(), &m_allocator, &m_drawList, m_frameSlots);
+    }
 }
 
 SwapchainDetails VulkanRenderer::getSwapchainDetails(const VkPhysicalDevice& dev)
@@ -461,12 +766,12 @@ VkSurfaceFormatKHR VulkanRenderer::getBestSurfaceFormat(const std::vector<VkSurf
 
 VkPresentModeKHR VulkanRenderer::getBestPresentMode(const std::vector<VkPresentModeKHR>& modes)
 {
-    for (const auto& mode : modes)
+    // First of the policy's modes the surface supports
+    for (auto preferred : getPresentSettings(m_presentPolicy).modes)
     {
-        // Mailbox is prefered mode
-        if (mode == VK_PRESENT_MODE_MAILBOX_KHR)
+        if (std::find(modes.begin(), modes.end(), preferred) != modes.end())
         {
-            return mode;
+            return preferred;
         }
     }
 
@@ -474,6 +779,21 @@ VkPresentModeKHR VulkanRenderer::getBestPresentMode(const std::vector<VkPresentM
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+uint32_t VulkanRenderer::getSwapchainImageCount(const VkSurfaceCapabilitiesKHR& capabilities, VkPresentModeKHR mode)
+{
+    // Min Image Count - more images means less waiting for one to come back but more frames queued up
+    // Mailbox always needs one spare to render into while the others are queued, and there should be
+    // one more than the frames in flight so a frame never has to wait on the one before it for an image
+    uint32_t imageCount = capabilities.minImageCount + getPresentSettings(m_presentPolicy).extraImages;
+    if (mode == VK_PRESENT_MODE_MAILBOX_KHR) imageCount = std::max(imageCount, capabilities.minImageCount + 1);
+    imageCount = std::max(imageCount, m_framesInFlight + 1);
+    if (capabilities.maxImageCount != 0 && imageCount > capabilities.maxImageCount)
+    {
+        imageCount = capabilities.maxImageCount;
+    }
+    return imageCount;
+}
+
 VkExtent2D VulkanRenderer::getBestSwapchainExtent(const VkSurfaceCapabilitiesKHR& capabilities)
 {
     if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
@@ -487,12 +807,12 @@ VkExtent2D VulkanRenderer::getBestSwapchainExtent(const VkSurfaceCapabilitiesKHR
 
         width = std::clamp(
             static_cast<uint32_t>(width),
-            capabilities.maxImageExtent.width,
+            capabilities.minImageExtent.width,
             capabilities.maxImageExtent.width
         );
         height = std::clamp(
             static_cast<uint32_t>(height),
-            capabilities.maxImageExtent.height,
+            capabilities.minImageExtent.height,
             capabilities.maxImageExtent.height
         );
 
@@ -527,20 +847,30 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
     };
 
     VkImageView view;
-    if (vkCreateImageView(m_device.logical, &viewInfo, nullptr, &view) != VK_SUCCESS)
+    if (vkCreateImageView(m_device.logical, &viewInfo, m_hostAllocator.getCallbacks(), &view) != VK_SUCCESS)
     {
         throw std::runtime_error("Failed to create VkImageView");
     }
     return view;
 }
 
-void VulkanRenderer::createSwapChain()
+void VulkanRenderer::createSwapChain(VkSwapchainKHR oldSwapchain)
 {
     auto swapchainDetails = getSwapchainDetails(m_device.physical);
 
     // Steps
     // 1. Choose best surface format
+    // A new swapchain keeps the format the render pass was built for as long as the surface still offers it
     auto format = getBestSurfaceFormat(swapchainDetails.formats);
+    for (const auto& supported : swapchainDetails.formats)
+    {
+        if (supported.format == m_surface.format && m_surface.format != VK_FORMAT_UNDEFINED) format = supported;
+    }
+    if (swapchainDetails.formats.size() == 1 && swapchainDetails.formats[0].format == VK_FORMAT_UNDEFINED &&
+        m_surface.format != VK_FORMAT_UNDEFINED)
+    {
+        format.format = m_surface.format;
+    }
     m_surface.format = format.format;
     // 2. Choose best presentation mode
     auto mode = getBestPresentMode(swapchainDetails.presentModes);
@@ -548,14 +878,8 @@ void VulkanRenderer::createSwapChain()
     auto extents = getBestSwapchainExtent(swapchainDetails.surfaceCapabilities);
     m_surface.extent = extents;
 
-    // Min Image Count - shoould get 1 more than minimum to allw for triple buffering
-    uint32_t imageCount = swapchainDetails.surfaceCapabilities.minImageCount + 1;
-    if (
-        swapchainDetails.surfaceCapabilities.maxImageCount != 0 &&
-        imageCount > swapchainDetails.surfaceCapabilities.maxImageCount
-    ) {
-        imageCount = swapchainDetails.surfaceCapabilities.maxImageCount;
-    }
+    // 4. Choose image count
+    uint32_t imageCount = getSwapchainImageCount(swapchainDetails.surfaceCapabilities, mode);
 
     VkSwapchainCreateInfoKHR swapchainInfo =
     {
@@ -574,7 +898,7 @@ void VulkanRenderer::createSwapChain()
         .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
         .presentMode = mode,
         .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE // used for recycling swap chain (e.g. on window resize)
+        .oldSwapchain = oldSwapchain // used for recycling swap chain (e.g. on window resize)
     };
 
     auto indices = getQueueFamilies(m_device.physical);
@@ -590,7 +914,10 @@ void VulkanRenderer::createSwapChain()
         swapchainInfo.pQueueFamilyIndices = queueIndices;
     }
 
-    vkCreateSwapchainKHR(m_device.logical, &swapchainInfo, nullptr, &m_swapchain);
+    if (vkCreateSwapchainKHR(m_device.logical, &swapchainInfo, m_hostAllocator.getCallbacks(), &m_swapchain) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Could not create swapchain");
+    }
 
     uint32_t numSwapchainImages = 0;
     vkGetSwapchainImagesKHR(m_device.logical, m_swapchain, &numSwapchainImages, nullptr);
@@ -608,7 +935,83 @@ void VulkanRenderer::createSwapChain()
             )
         });
     }
-    assert(m_swapchainImages.size() > MAX_FRAME_DRAWS); // this needs to be true to prevent possible synchronization bugs
+    m_imageFrames.assign(m_swapchainImages.size(), 0);   // nothing has rendered to them yet
+}
+
+void VulkanRenderer::recreateSwapChain()
+{
+    // Nothing to draw to while minimised, sleep until the window is back instead of spinning through frames
+    // (or is closed, then the caller's loop ends)
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(m_window, &width, &height);
+    while ((width == 0 || height == 0) && !glfwWindowShouldClose(m_window))
+    {
+        glfwWaitEvents();
+        glfwGetFramebufferSize(m_window, &width, &height);
+    }
+    if (width == 0 || height == 0) return;
+
+    // Presents of the old swapchain can still be queued, so instead of idling the device it's handed to the
+    // new one as oldSwapchain and everything that belongs to it waits in m_retiredSwapchains
+    // Present has no completion signal, but once every frame in flight after these has completed on the
+    // timeline the presentation engine has moved on to the new images
+    RetiredSwapchain retired =
+    {
+        .swapchain = m_swapchain,
+        .framebuffers = std::move(m_framebuffers),
+        .renderFinished = std::move(m_renderFinished),
+        .framesLeft = m_frameSlots
+    };
+    for (auto& image : m_swapchainImages)
+    {
+        retired.imageViews.push_back(image.imageView);
+    }
+    m_swapchainImages.clear();
+    m_framebuffers.clear();
+    m_renderFinished.clear();
+    m_retiredSwapchains.push_back(std::move(retired));
+
+    // Only what depends on the images and their size, the pipeline takes viewport and scissor per recording
+    VkFormat oldFormat = m_surface.format;
+    createSwapChain(m_retiredSwapchains.back().swapchain);
+    if (m_surface.format != oldFormat)
+    {
+        // The surface dropped our format (e.g. moved to another display), the render pass and the pipelines
+        // built for it have to go too. Rare enough to just let the frames in flight finish first
+        vkDeviceWaitIdle(m_device.logical);
+        destroyGraphicsPipeline();
+        createGraphicsPipeline();
+    }
+    createFramebuffers();
+    createPresentSemaphores();
+    m_swapchainOutdated = false;
+}
+
+void VulkanRenderer::releaseRetiredSwapchains()
+{
+    while (!m_retiredSwapchains.empty() && m_retiredSwapchains.front().framesLeft == 0 &&
+        m_frameTimeline.isComplete(m_retiredSwapchains.front().frame))
+    {
+        destroyRetiredSwapchain(m_retiredSwapchains.front());
+        m_retiredSwapchains.pop_front();
+    }
+}
+
+void VulkanRenderer::destroyRetiredSwapchain(RetiredSwapchain& retired)
+{
+    for (auto framebuffer : retired.framebuffers)
+    {
+        vkDestroyFramebuffer(m_device.logical, framebuffer, m_hostAllocator.getCallbacks());
+    }
+    for (auto imageView : retired.imageViews)
+    {
+        vkDestroyImageView(m_device.logical, imageView, m_hostAllocator.getCallbacks());
+    }
+    for (auto semaphore : retired.renderFinished)
+    {
+        vkDestroySemaphore(m_device.logical, semaphore, m_hostAllocator.getCallbacks());
+    }
+    vkDestroySwapchainKHR(m_device.logical, retired.swapchain, m_hostAllocator.getCallbacks());
 }
 
 VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
@@ -621,7 +1024,7 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
     };
 
     VkShaderModule shaderModule;
-    if (vkCreateShaderModule(m_device.logical, &shaderInfo, nullptr, &shaderModule) != VK_SUCCESS)
+    if (vkCreateShaderModule(m_device.logical, &shaderInfo, m_hostAllocator.getCallbacks(), &shaderModule) != VK_SUCCESS)
     {
         throw std::runtime_error("Failed to create shader module");
     }
@@ -698,12 +1101,104 @@ void VulkanRenderer::createRenderPass()
         .pDependencies = subpassDependencies.data(),
     };
 
-    if (vkCreateRenderPass(m_device.logical, &renderPassInfo, nullptr, &m_renderpass) != VK_SUCCESS)
+    if (vkCreateRenderPass(m_device.logical, &renderPassInfo, m_hostAllocator.getCallbacks(), &m_renderpass) != VK_SUCCESS)
     {
         throw std::runtime_error("Could not create render pass");
     }
 }
 
+void VulkanRenderer::createDescriptorSetLayout()
+{
+    // FrameUniforms and DrawData, the offsets of this frame's copies are given at bind time
+    std::array<VkDescriptorSetLayoutBinding, 2> frameBindings =
+    {{
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+        }
+    }};
+    VkDescriptorSetLayoutCreateInfo layoutInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(frameBindings.size()),
+        .pBindings = frameBindings.data()
+    };
+    if (vkCreateDescriptorSetLayout(m_device.logical, &layoutInfo, m_hostAllocator.getCallbacks(), &m_frameSetLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create descriptor set layout");
+    }
+}
+
+void VulkanRenderer::createDescriptorSet()
+{
+    std::array<VkDescriptorPoolSize, 2> poolSizes =
+    {{
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1 }
+    }};
+    VkDescriptorPoolCreateInfo poolInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+        .pPoolSizes = poolSizes.data()
+    };
+    if (vkCreateDescriptorPool(m_device.logical, &poolInfo, m_hostAllocator.getCallbacks(), &m_descriptorPool) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create descriptor pool");
+    }
+
+    VkDescriptorSetAllocateInfo setInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = m_descriptorPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &m_frameSetLayout
+    };
+    if (vkAllocateDescriptorSets(m_device.logical, &setInfo, &m_frameSet) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to allocate descriptor set");
+    }
+
+    // Written once, every frame only changes the dynamic offsets
+    VkDescriptorBufferInfo uniformInfo =
+    {
+        .buffer = m_uniforms.getBuffer(),
+        .offset = 0,
+        .range = sizeof(FrameUniforms)
+    };
+    VkDescriptorBufferInfo drawDataInfo = m_drawDataBuffer.getFrame(0);
+    drawDataInfo.offset = 0;    // the frame's segment is picked by the dynamic offset
+    std::array<VkWriteDescriptorSet, 2> writes =
+    {{
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = m_frameSet,
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .pBufferInfo = &uniformInfo
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = m_frameSet,
+            .dstBinding = 1,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .pBufferInfo = &drawDataInfo
+        }
+    }};
+    vkUpdateDescriptorSets(m_device.logical, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
 void VulkanRenderer::createGraphicsPipeline()
 {
     auto vertexShader = readFile("shader/vertex.spv");
@@ -740,15 +1235,22 @@ void VulkanRenderer::createGraphicsPipeline()
     };
 
     // Create Vertex Input
-    VkVertexInputBindingDescription bindingDesc =   // Data layout for a single vertex
-    {
-        .binding = 0,                               // Can define multiple streams of data
-        .stride = sizeof(Vertex),
-        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX    // How to iterate over data after each vertex
-                                                    // VK_VERTEX_INPUT_RATE_VERTEX: move onto next vertex
-                                                    // VK_VERTEX_INPUT_RATE_INSTANCE: move onto same vertex of different instance
+    std::array<VkVertexInputBindingDescription, 2> bindingDesc =
+    {
+        VkVertexInputBindingDescription{            // Data layout for a single vertex
+            .binding = 0,                           // Can define multiple streams of data
+            .stride = sizeof(Vertex),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX    // How to iterate over data after each vertex
+                                                        // VK_VERTEX_INPUT_RATE_VERTEX: move onto next vertex
+                                                        // VK_VERTEX_INPUT_RATE_INSTANCE: move onto same vertex of different instance
+        },
+        VkVertexInputBindingDescription{            // Data layout for a single instance
+            .binding = 1,
+            .stride = sizeof(InstanceData),
+            .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
+        },
     };
-    std::array<VkVertexInputAttributeDescription, 2> attributeDesc =
+    std::array<VkVertexInputAttributeDescription, 8> attributeDesc =
     {
         VkVertexInputAttributeDescription{          // layout(location = 0) in vec3 position
             .binding = 0,
@@ -762,12 +1264,48 @@ void VulkanRenderer::createGraphicsPipeline()
             .format = VK_FORMAT_R32G32B32_SFLOAT,
             .offset = offsetof(Vertex, color),
         },
+        VkVertexInputAttributeDescription{          // layout(location = 2) in mat4 instanceTransform, one location per column
+            .binding = 1,
+            .location = 2,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(InstanceData, transform),
+        },
+        VkVertexInputAttributeDescription{
+            .binding = 1,
+            .location = 3,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(InstanceData, transform) + sizeof(glm::vec4),
+        },
+        VkVertexInputAttributeDescription{
+            .binding = 1,
+            .location = 4,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(InstanceData, transform) + 2 * sizeof(glm::vec4),
+        },
+        VkVertexInputAttributeDescription{
+            .binding = 1,
+            .location = 5,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(InstanceData, transform) + 3 * sizeof(glm::vec4),
+        },
+        VkVertexInputAttributeDescription{          // layout(location = 6) in vec4 instanceColor
+            .binding = 1,
+            .location = 6,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(InstanceData, color),
+        },
+        VkVertexInputAttributeDescription{          // layout(location = 7) in uint instanceDraw
+            .binding = 1,
+            .location = 7,
+            .format = VK_FORMAT_R32_UINT,
+            .offset = offsetof(InstanceData, draw),
+        },
     };
     VkPipelineVertexInputStateCreateInfo vertexInputInfo =
     {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &bindingDesc,
+        .vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDesc.size()),
+        .pVertexBindingDescriptions = bindingDesc.data(),
         .vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDesc.size()),
         .pVertexAttributeDescriptions = attributeDesc.data()
     };
@@ -782,34 +1320,19 @@ void VulkanRenderer::createGraphicsPipeline()
 
     // Viewport and Scissor
     // View port defines what section of window the image should map to
-    // We just use the whole window
-    VkViewport viewport =
-    {
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = float(m_surface.extent.width),
-        .height = float(m_surface.extent.height),
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f
-    };
-    // the scissor is basically a cropping tool so just use the whole window again
-    VkRect2D scissor =
-    {
-        .offset = {0, 0},
-        .extent = m_surface.extent
-    };
-
+    // Both follow the window size so they are set when recording (see beginDrawSecondary), which means
+    // the pipeline survives a resize
     VkPipelineViewportStateCreateInfo viewportInfo =
     {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
         .viewportCount = 1,
-        .pViewports = &viewport,
+        .pViewports = nullptr,
         .scissorCount = 1,
-        .pScissors = &scissor
+        .pScissors = nullptr
     };
 
-    // Dynamic States (FOR REFERENCE)
-    /*std::vector<VkDynamicState> dynamicStateEnables[] =
+    // Dynamic States
+    std::array<VkDynamicState, 2> dynamicStateEnables =
     {
         VK_DYNAMIC_STATE_VIEWPORT, // enables changing viewport in command buffer with vkCmdSetViewport(cmdbuffer, index:0, count:1, &viewport)
         VK_DYNAMIC_STATE_SCISSOR   // ""      ""       scissor  "" ""      ""     ""   vkCmdSetScissor(cmdbuffer, 1, 0, &scissor)
@@ -820,7 +1343,7 @@ void VulkanRenderer::createGraphicsPipeline()
         .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
         .dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size()),
         .pDynamicStates = dynamicStateEnables.data()
-    };*/
+    };
 
     // Create Rasterizer
     VkPipelineRasterizationStateCreateInfo rasterizerInfo =
@@ -869,18 +1392,26 @@ void VulkanRenderer::createGraphicsPipeline()
         .pAttachments = &blendAttachmentInfo,
     };
 
-    // Pipeliane Layout (TODO: Apply descriptor set layouts)
+    // Per draw model matrix, small enough for push constants (every device has at least 128 bytes)
+    VkPushConstantRange pushRange =
+    {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(DrawConstants)
+    };
+
+    // Pipeliane Layout
     VkPipelineLayoutCreateInfo layoutInfo =
     {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 0,
-        .pSetLayouts = nullptr,
-        .pushConstantRangeCount = 0,
-        .pPushConstantRanges = nullptr
+        .setLayoutCount = 1,
+        .pSetLayouts = &m_frameSetLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushRange
     };
 
     // Create Pipeline Layout
-    if (vkCreatePipelineLayout(m_device.logical, &layoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS)
+    if (vkCreatePipelineLayout(m_device.logical, &layoutInfo, m_hostAllocator.getCallbacks(), &m_pipelineLayout) != VK_SUCCESS)
     {
         throw std::runtime_error("Failed to create pipeline layout");
     }
@@ -896,7 +1427,7 @@ void VulkanRenderer::createGraphicsPipeline()
         .pVertexInputState = &vertexInputInfo,
         .pInputAssemblyState = &inputAssemblyInfo,
         .pViewportState = &viewportInfo,
-        .pDynamicState = nullptr,
+        .pDynamicState = &dynamicInfo,
         .pRasterizationState = &rasterizerInfo,
         .pMultisampleState = &multisampleInfo,
         .pColorBlendState = &blendInfo,
@@ -909,15 +1440,47 @@ void VulkanRenderer::createGraphicsPipeline()
         .basePipelineIndex = -1,                        // Can create multiple pipelines at a time and select one to use as a base for the rest6
     };
 
-    if (vkCreateGraphicsPipelines(m_device.logical, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_gfxpipeline) != VK_SUCCESS)
+    if (vkCreateGraphicsPipelines(m_device.logical, VK_NULL_HANDLE, 1, &pipelineInfo, m_hostAllocator.getCallbacks(), &m_gfxpipeline) != VK_SUCCESS)
     {
         throw std::runtime_error("Could not create Graphics Pipeline");
     }
 
+    if (m_vertexPulling)
+    {
+        // Same pipeline with the vertex fetch moved into the shader, only the instance stream is left as input
+        auto pullModule = createShaderModule(readFile("shader/vertex_pull.spv"));
+        shaderStages[0].module = pullModule;
+
+        VkPipelineVertexInputStateCreateInfo pullInputInfo =
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+            .vertexBindingDescriptionCount = 1,
+            .pVertexBindingDescriptions = &bindingDesc[1],
+            .vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDesc.size() - 2),
+            .pVertexAttributeDescriptions = &attributeDesc[2]
+        };
+        pipelineInfo.pVertexInputState = &pullInputInfo;
+
+        VkResult result = vkCreateGraphicsPipelines(m_device.logical, VK_NULL_HANDLE, 1, &pipelineInfo, m_hostAllocator.getCallbacks(), &m_pullPipeline);
+        vkDestroyShaderModule(m_device.logical, pullModule, m_hostAllocator.getCallbacks());
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("Could not create vertex pulling Graphics Pipeline");
+        }
+    }
+
     // Can destroy here since we are done with shaders
     // Could keep them around if they will be needed in other pipelines
-    vkDestroyShaderModule(m_device.logical, fragmentModule, nullptr);
-    vkDestroyShaderModule(m_device.logical, vertexModule, nullptr);
+    vkDestroyShaderModule(m_device.logical, fragmentModule, m_hostAllocator.getCallbacks());
+    vkDestroyShaderModule(m_device.logical, vertexModule, m_hostAllocator.getCallbacks());
+}
+
+void VulkanRenderer::destroyGraphicsPipeline()
+{
+    vkDestroyPipeline(m_device.logical, m_gfxpipeline, m_hostAllocator.getCallbacks());
+    if (m_vertexPulling) vkDestroyPipeline(m_device.logical, m_pullPipeline, m_hostAllocator.getCallbacks());
+    vkDestroyPipelineLayout(m_device.logical, m_pipelineLayout, m_hostAllocator.getCallbacks());
+    vkDestroyRenderPass(m_device.logical, m_renderpass, m_hostAllocator.getCallbacks());
 }
 
 void VulkanRenderer::createFramebuffers()
@@ -943,7 +1506,7 @@ void VulkanRenderer::createFramebuffers()
             .layers = 1
         };
 
-        if (vkCreateFramebuffer(m_device.logical, &framebufferInfo, nullptr, &m_framebuffers[i]) != VK_SUCCESS)
+        if (vkCreateFramebuffer(m_device.logical, &framebufferInfo, m_hostAllocator.getCallbacks(), &m_framebuffers[i]) != VK_SUCCESS)
         {
             throw std::runtime_error("Could not create framebuffer");
         }
@@ -958,39 +1521,76 @@ void VulkanRenderer::createCommandPool()
     VkCommandPoolCreateInfo poolInfo =
     {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,  // everything in it is re-recorded every frame
         .queueFamilyIndex = static_cast<uint32_t>(indices.graphicsFamily)
     };
 
-    if (vkCreateCommandPool(m_device.logical, &poolInfo, nullptr, &m_gfxCommandPool) != VK_SUCCESS)
+    m_frameCommands.resize(m_frameSlots);
+    for (auto& frame : m_frameCommands)
     {
-        throw std::runtime_error("Failed to create command pool");
+        if (vkCreateCommandPool(m_device.logical, &poolInfo, m_hostAllocator.getCallbacks(), &frame.pool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create command pool");
+        }
+
+        // Pools aren't thread safe, so one for every slice of draws that can be recorded at the same time
+        frame.slicePools.resize(m_workers.getThreadCount());
+        for (auto& pool : frame.slicePools)
+        {
+            if (vkCreateCommandPool(m_device.logical, &poolInfo, m_hostAllocator.getCallbacks(), &pool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create recording command pool");
+            }
+        }
     }
 }
 
 void VulkanRenderer::allocateCommandBuffers()
 {
-    m_commandBuffers.resize(m_framebuffers.size());
-
-    VkCommandBufferAllocateInfo cmdBufferInfo =
+    // Allocated once, resetting the pools keeps the command buffers around for the next recording
+    for (auto& frame : m_frameCommands)
     {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = m_gfxCommandPool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,       // PRIMARY: executed by queue, SECONDARY: executed by PRIMARYs (see vkExecuteCommand)
-        .commandBufferCount = static_cast<uint32_t>(m_commandBuffers.size())
-    };
+        std::array<VkCommandBuffer, 2> primaries;
+        VkCommandBufferAllocateInfo cmdBufferInfo =
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = frame.pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,       // PRIMARY: executed by queue, SECONDARY: executed by PRIMARYs (see vkExecuteCommand)
+            .commandBufferCount = static_cast<uint32_t>(primaries.size())
+        };
 
-    if (vkAllocateCommandBuffers(m_device.logical, &cmdBufferInfo, m_commandBuffers.data()) != VK_SUCCESS)
-    {
-        throw std::runtime_error("Could not create command buffers");
+        if (vkAllocateCommandBuffers(m_device.logical, &cmdBufferInfo, primaries.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Could not create command buffers");
+        }
+        frame.primary = primaries[0];
+        frame.defrag = primaries[1];
+
+        frame.secondaries.resize(frame.slicePools.size());
+        frame.encoders.resize(frame.slicePools.size());
+        for (size_t slice = 0; slice < frame.slicePools.size(); slice++)
+        {
+            VkCommandBufferAllocateInfo secondaryInfo =
+            {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = frame.slicePools[slice],
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1
+            };
+            if (vkAllocateCommandBuffers(m_device.logical, &secondaryInfo, &frame.secondaries[slice]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Could not create secondary command buffers");
+            }
+        }
     }
 }
 
-void VulkanRenderer::recordCommands()
+void VulkanRenderer::recordCommands(FrameCommands& frame, uint32_t image)
 {
     VkCommandBufferBeginInfo bufferBeginInfo =
     {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        //.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT   // allows multiple uses of the same command buffer at the same time
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT    // recorded again next time this frame slot comes around
     };
 
     VkClearValue clearValues[] =
@@ -1002,80 +1602,476 @@ void VulkanRenderer::recordCommands()
     {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
         .renderPass = m_renderpass,
+        .framebuffer = m_framebuffers[image],
         .renderArea.offset = {0, 0},       // start point of render area
         .renderArea.extent = m_surface.extent,
         .pClearValues = clearValues,
         .clearValueCount = 1
     };
 
-    for (size_t i = 0; i < m_commandBuffers.size(); i++)
+    // Split the draws into slices, only as many as there are threads and never so small that
+    // the cost of an extra secondary command buffer outweighs recording it in parallel
+    size_t minSlices = (m_meshes.size() + MIN_DRAWS_PER_RECORD_TASK - 1) / MIN_DRAWS_PER_RECORD_TASK;
+    uint32_t sliceCount = static_cast<uint32_t>(std::clamp<size_t>(minSlices, 1, frame.slicePools.size()));
+    size_t meshesPerSlice = (m_meshes.size() + sliceCount - 1) / sliceCount;
+
+    // The culled draws come out compacted behind a single count, so they have to fit in one call
+    frame.culled = m_indirectDraws && m_gpuCulling && m_drawList.getCount() <= m_maxDrawIndirectCount;
+
+    if (m_indirectDraws)
     {
-        renderpassBeginInfo.framebuffer = m_framebuffers[i];
+        // The recording cost doesn't depend on the number of meshes, no point spreading it over threads
+        sliceCount = 1;
+        recordIndirectDraws(frame, image);
+    }
+    else
+    {
+        // Slices are consecutive runs of the sorted draws so state changes stay rare within each
+        sortMeshDraws();
+        m_workers.run(sliceCount, [&](uint32_t slice)
+        {
+            size_t firstDraw = std::min(m_drawOrder.size(), slice * meshesPerSlice);
+            size_t endDraw = std::min(m_drawOrder.size(), firstDraw + meshesPerSlice);
+            recordDrawSlice(frame, image, slice, firstDraw, endDraw);
+        });
+    }
+
+    if (vkBeginCommandBuffer(frame.primary, &bufferBeginInfo) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to start recording command buffer");
+    }
+
+    // Culling is compute work so it has to happen before the pass starts
+    if (frame.culled)
+    {
+        m_culler.record(frame.primary, m_currentFrame, m_viewProj);
+    }
+
+    {   // Render Pass Start
+        // Everything inside the pass comes from the secondary command buffers (in slice order)
+        vkCmdBeginRenderPass(frame.primary, &renderpassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+        vkCmdExecuteCommands(frame.primary, sliceCount, frame.secondaries.data());
 
-        if (vkBeginCommandBuffer(m_commandBuffers[i], &bufferBeginInfo) != VK_SUCCESS)
+        vkCmdEndRenderPass(frame.primary);
+    }   // Render Pass End
+
+    if (vkEndCommandBuffer(frame.primary) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to end recording command buffer");
+    }
+}
+
+void VulkanRenderer::recordDrawSlice(FrameCommands& frame, uint32_t image, uint32_t slice, size_t firstDraw, size_t endDraw)
+{
+    CommandEncoder& encoder = beginDrawSecondary(frame, image, slice);
+
+    {   // Begin Drawing Commands
+        for (size_t d = firstDraw; d < endDraw; d++)
         {
-            throw std::runtime_error("Failed to start recording command buffer");
+            // Every mesh binds what it needs, the encoder drops the binds when it's the same as the
+            // last mesh's (always with the geometry pool, but meshes don't have to rely on that)
+            Mesh& mesh = m_meshes[m_drawOrder[d].index];
+            bindVertexStreams(encoder, frame, mesh.getVertexBuffer());
+            encoder.bindIndexBuffer(mesh.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+
+            DrawConstants constants = { mesh.getTransform() };
+            encoder.pushConstants(m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawConstants), &constants);
+
+            // All instances of the mesh at once
+            encoder.drawIndexed(
+                static_cast<uint32_t>(mesh.getIndexCount()),
+                static_cast<uint32_t>(mesh.getInstances().size()),
+                mesh.getFirstIndex(),
+                mesh.getVertexOffset(),
+                mesh.getFirstInstance()
+            );
         }
+    }   // End Drawing Commands
 
-        {   // Render Pass Start
-            vkCmdBeginRenderPass(m_commandBuffers[i], &renderpassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    if (vkEndCommandBuffer(encoder.getCommandBuffer()) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to end recording secondary command buffer");
+    }
+}
 
-            {   // Begin Drawing Commands
-                vkCmdBindPipeline(m_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_gfxpipeline);
+void VulkanRenderer::recordIndirectDraws(FrameCommands& frame, uint32_t image)
+{
+    // Only the commands that changed since this frame slot was last used get written
+    VkDescriptorBufferInfo drawBuffer = m_drawList.prepareFrame(m_currentFrame);
+    uint32_t drawCount = m_drawList.getCount();
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
 
-                std::vector<VkBuffer> vertexBuffers;
-                for (auto& mesh : m_meshes)
-                {
-                    VkBuffer vertexBuffers[] = { mesh.getVertexBuffer() };
-                    VkDeviceSize offsets[] = { 0 }; // offsets into buffers being boud
-                    vkCmdBindVertexBuffers(m_commandBuffers[i], 0, 1, vertexBuffers, offsets);
+    CommandEncoder& encoder = beginDrawSecondary(frame, image, 0);
 
-                    vkCmdBindIndexBuffer(m_commandBuffers[i], mesh.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+    {   // Begin Drawing Commands
+        // Every mesh lives in the geometry pool so the buffers are bound once for all draws
+        // and so are the instances of every mesh
+        bindVertexStreams(encoder, frame, m_geometry.getVertexBuffer());
+        encoder.bindIndexBuffer(m_geometry.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
 
-                    //vkCmdDraw(m_commandBuffers[i], static_cast<uint32_t>(m_firstMesh.getVertexCount()), 1, 0, 0);
-                    vkCmdDrawIndexed(m_commandBuffers[i], static_cast<uint32_t>(mesh.getIndexCount()), 1, 0, 0, 0);
-                }
-            }   // End Drawing Commands
+        // One push for every draw, the mesh transforms come from their DrawData (see writeDrawData)
+        DrawConstants constants = { glm::mat4(1.0f) };
+        encoder.pushConstants(m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawConstants), &constants);
 
-            vkCmdEndRenderPass(m_commandBuffers[i]);
-        }   // Render Pass End
+        if (frame.culled)
+        {
+            // Only what survived culling, the count never leaves the GPU
+            encoder.drawIndexedIndirectCount(
+                m_culler.getVisibleDraws(m_currentFrame), 0,
+                m_culler.getVisibleCount(m_currentFrame), 0,
+                drawCount,
+                stride
+            );
+        }
+        else if (m_multiDrawIndirect)
+        {
+            for (uint32_t first = 0; first < drawCount; first += m_maxDrawIndirectCount)
+            {
+                uint32_t count = std::min(m_maxDrawIndirectCount, drawCount - first);
+                encoder.drawIndexedIndirect(drawBuffer.buffer, drawBuffer.offset + VkDeviceSize(first) * stride, count, stride);
+            }
+        }
+        else
+        {
+            for (uint32_t d = 0; d < drawCount; d++)
+            {
+                encoder.drawIndexedIndirect(drawBuffer.buffer, drawBuffer.offset + VkDeviceSize(d) * stride, 1, stride);
+            }
+        }
+    }   // End Drawing Commands
+
+    if (vkEndCommandBuffer(encoder.getCommandBuffer()) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to end recording secondary command buffer");
+    }
+}
+
+void VulkanRenderer::bindVertexStreams(CommandEncoder& encoder, FrameCommands& frame, VkBuffer vertexBuffer)
+{
+    VkDeviceSize offsets[] = { 0, frame.instances.offset }; // offsets into buffers being boud
+    if (m_vertexPulling)
+    {
+        // The shader finds the vertices itself, only the instances come through a binding
+        encoder.bindVertexBuffers(1, 1, &frame.instances.buffer, &offsets[1]);
+    }
+    else
+    {
+        VkBuffer vertexBuffers[] = { vertexBuffer, frame.instances.buffer };
+        encoder.bindVertexBuffers(0, 2, vertexBuffers, offsets);
+    }
+}
 
-        if (vkEndCommandBuffer(m_commandBuffers[i]) != VK_SUCCESS)
+void VulkanRenderer::sortMeshDraws()
+{
+    m_drawOrder.clear();
+    for (uint32_t m = 0; m < m_meshes.size(); m++)
+    {
+        // Depth of the centre of all instances, good enough to get most of the overdraw out of the way
+        glm::vec4 bounds = m_meshes[m].getBounds();
+        glm::vec4 clip = m_viewProj * glm::vec4(glm::vec3(bounds), 1.0f);
+        float depth = clip.w > 0.0f ? clip.z / clip.w : 0.0f;
+
+        // One pass, pipeline and material so far, the fields are there for when there are more
+        m_drawOrder.push_back({ makeSortKey(0, 0, 0, m_meshes[m].getGeometry(), depth), m });
+    }
+    sortDraws(m_drawOrder, m_sortScratch);
+}
+
+CommandEncoder& VulkanRenderer::beginDrawSecondary(FrameCommands& frame, uint32_t image, uint32_t slice)
+{
+    VkCommandBuffer commandBuffer = frame.secondaries[slice];
+
+    // Secondaries that run inside a render pass need to know which one (and which framebuffer)
+    VkCommandBufferInheritanceInfo inheritanceInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = m_renderpass,
+        .subpass = 0,
+        .framebuffer = m_framebuffers[image]
+    };
+    VkCommandBufferBeginInfo bufferBeginInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = &inheritanceInfo
+    };
+
+    if (vkBeginCommandBuffer(commandBuffer, &bufferBeginInfo) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to start recording secondary command buffer");
+    }
+
+    // Secondaries don't inherit any state so every slice binds for itself
+    CommandEncoder& encoder = frame.encoders[slice];
+    encoder.begin(commandBuffer);
+    encoder.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_vertexPulling ? m_pullPipeline : m_gfxpipeline);
+    encoder.bindDescriptorSets(
+        VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_frameSet,
+        static_cast<uint32_t>(frame.dynamicOffsets.size()), frame.dynamicOffsets.data()
+    );
+
+    // We just use the whole window
+    VkViewport viewport =
+    {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = float(m_surface.extent.width),
+        .height = float(m_surface.extent.height),
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f
+    };
+    // the scissor is basically a cropping tool so just use the whole window again
+    VkRect2D scissor =
+    {
+        .offset = {0, 0},
+        .extent = m_surface.extent
+    };
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    return encoder;
+}
+
+bool VulkanRenderer::recordDefragment(VkCommandBuffer defragCommands)
+{
+    // A little compaction every frame, the copies are in the same submit as the draws so no idling
+    VkCommandBufferBeginInfo beginInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+    if (vkBeginCommandBuffer(defragCommands, &beginInfo) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to start recording defragmentation commands");
+    }
+    bool moved = m_geometry.defragment(defragCommands);
+    if (vkEndCommandBuffer(defragCommands) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to end recording defragmentation commands");
+    }
+    return moved;
+}
+
+void VulkanRenderer::addMeshDraw(Mesh& mesh)
+{
+    GeometryHandle geometry = mesh.getGeometry();
+    if (geometry >= m_geometryDraws.size()) m_geometryDraws.resize(geometry + 1);
+    m_geometryDraws[geometry] = m_drawList.add(mesh.getDrawCommand(), mesh.getBounds());
+}
+
+void VulkanRenderer::removeMeshDraw(Mesh& mesh)
+{
+    m_drawList.remove(m_geometryDraws[mesh.getGeometry()]);
+}
+
+void VulkanRenderer::updateMovedDraws()
+{
+    // Only the draws of geometry that just moved change, everything else stays as written
+    for (auto geometry : m_geometry.getMovedHandles())
+    {
+        DrawHandle draw = m_geometryDraws[geometry];
+        const GeometryRange& range = m_geometry.getRange(geometry);
+        VkDrawIndexedIndirectCommand command = m_drawList.get(draw);
+        command.firstIndex = range.firstIndex;
+        command.vertexOffset = static_cast<int32_t>(range.firstVertex);
+        m_drawList.update(draw, command);
+    }
+
+    // So does where vertex pulling reads them from
+    const auto& moved = m_geometry.getMovedHandles();
+    for (size_t m = 0; m < m_meshes.size(); m++)
+    {
+        if (std::find(moved.begin(), moved.end(), m_meshes[m].getGeometry()) != moved.end()) writeDrawData(m);
+    }
+}
+
+void VulkanRenderer::setPresentPolicy(PresentPolicy policy)
+{
+    if (policy == m_presentPolicy) return;
+
+    // Fewer frames in flight applies right away (the next frame waits for more), the slots are all there already
+    m_presentPolicy = policy;
+    if (m_settings.framesInFlight == 0) m_framesInFlight = getPresentSettings(policy).framesInFlight;
+    m_swapchainOutdated = true;
+}
+
+PresentPolicy VulkanRenderer::getPresentPolicy() const
+{
+    return m_presentPolicy;
+}
+
+void VulkanRenderer::addInstance(size_t mesh, const glm::mat4& transform, const glm::vec4& color)
+{
+    m_meshes[mesh].addInstance(transform, color);
+    m_instancesChanged = true;
+}
+
+void VulkanRenderer::setTransform(size_t mesh, const glm::mat4& transform)
+{
+    m_meshes[mesh].setTransform(transform);
+    writeDrawData(mesh);
+
+    // The bounds moved with it, the culler tests the draw list's copy
+    if (m_indirectDraws)
+    {
+        m_drawList.setBounds(m_geometryDraws[m_meshes[mesh].getGeometry()], m_meshes[mesh].getBounds());
+    }
+}
+
+void VulkanRenderer::writeDrawData(size_t mesh)
+{
+    if (mesh >= m_drawData.size()) m_drawData.resize(mesh + 1);
+
+    // A single indirect call can't push per draw, so there the transform is read from the draw data
+    m_drawData[mesh] =
+    {
+        .model = m_indirectDraws ? m_meshes[mesh].getTransform() : glm::mat4(1.0f),
+        .vertices = m_vertexPulling ? m_meshes[mesh].getVertexAddress() : 0,
+        .vertexOffset = m_meshes[mesh].getVertexOffset(),
+        .vertexLayout = m_meshes[mesh].getVertexLayout()
+    };
+    m_drawDataBuffer.markDirty(mesh * sizeof(DrawData), sizeof(DrawData));
+}
+
+void VulkanRenderer::packInstances()
+{
+    std::vector<InstanceData> instances;
+    for (uint32_t m = 0; m < m_meshes.size(); m++)
+    {
+        Mesh& mesh = m_meshes[m];
+        mesh.setFirstInstance(static_cast<uint32_t>(instances.size()));
+        for (auto& instance : mesh.getInstances())
         {
-            throw std::runtime_error("Failed to end recording command buffer");
+            instances.push_back(instance);
+            instances.back().draw = m;
         }
+
+        DrawHandle draw = m_geometryDraws[mesh.getGeometry()];
+        m_drawList.update(draw, mesh.getDrawCommand());
+        m_drawList.setBounds(draw, mesh.getBounds());
     }
+    m_instanceBuffer.write(instances);
+    m_instancesChanged = false;
 }
 
 void VulkanRenderer::createSynchronization()
 {
-    m_imageAvailable.resize(MAX_FRAME_DRAWS);
-    m_renderFinished.resize(MAX_FRAME_DRAWS);
-    m_drawFences.resize(MAX_FRAME_DRAWS);
+    m_imageAvailable.resize(m_frameSlots);
+    m_slotFrames.assign(m_frameSlots, 0);
 
     VkSemaphoreCreateInfo semInfo =
     {
         .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
     };
-    VkFenceCreateInfo fenceInfo =
-    {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT
-    };
 
-    for (size_t i = 0; i < MAX_FRAME_DRAWS; i++)
+    for (auto& semaphore : m_imageAvailable)
     {
-        if (vkCreateSemaphore(m_device.logical, &semInfo, nullptr, &m_imageAvailable[i]) != VK_SUCCESS)
+        if (vkCreateSemaphore(m_device.logical, &semInfo, m_hostAllocator.getCallbacks(), &semaphore) != VK_SUCCESS)
         {
             throw std::runtime_error("Could not create imageAvailable semaphore");
         }
-        if (vkCreateSemaphore(m_device.logical, &semInfo, nullptr, &m_renderFinished[i]) != VK_SUCCESS)
+    }
+    createPresentSemaphores();
+}
+
+void VulkanRenderer::createPresentSemaphores()
+{
+    m_renderFinished.resize(m_swapchainImages.size());
+
+    VkSemaphoreCreateInfo semInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+    };
+    for (auto& semaphore : m_renderFinished)
+    {
+        if (vkCreateSemaphore(m_device.logical, &semInfo, m_hostAllocator.getCallbacks(), &semaphore) != VK_SUCCESS)
         {
             throw std::runtime_error("Could not create renderFinished semaphore");
         }
-        if (vkCreateFence(m_device.logical, &fenceInfo, nullptr, &m_drawFences[i]) != VK_SUCCESS)
+    }
+}
+
+void VulkanRenderer::printUploadStats(double totalMilliseconds)
+{
+    const UploadStats& stats = m_geometry.getUploadStats();
+    std::cout << "Geometry uploads (" << (m_geometry.canWriteDirect() ? "unified memory" : "staged memory") << "), "
+        << totalMilliseconds << " ms until usable" << std::endl;
+    std::cout << "  direct: " << stats.directUploads << " uploads, " << stats.directBytes << " bytes, "
+        << stats.directSeconds * 1000.0 << " ms on the host" << std::endl;
+    std::cout << "  staged: " << stats.stagedUploads << " uploads, " << stats.stagedBytes << " bytes, "
+        << stats.stagedSeconds * 1000.0 << " ms on the host" << std::endl;
+}
+
+void VulkanRenderer::printHostAllocationStats()
+{
+    const char* scopeNames[HOST_ALLOCATION_SCOPES] = { "command", "object", "cache", "device", "instance" };
+
+    std::cout << "Driver host allocations" << std::endl;
+    for (uint32_t scope = 0; scope < HOST_ALLOCATION_SCOPES; scope++)
+    {
+        HostScopeStats stats = m_hostAllocator.getStats(static_cast<VkSystemAllocationScope>(scope));
+        std::cout << "  " << scopeNames[scope] << ": "
+            << stats.allocations << " allocs, " << stats.reallocations << " reallocs, " << stats.frees << " frees, "
+            << stats.totalBytes << " bytes total, " << stats.peakBytes << " peak, " << stats.liveBytes << " live, "
+            << stats.internalBytes << " internal" << std::endl;
+    }
+}
+
+void VulkanRenderer::printEncoderStats()
+{
+    const char* callNames[size_t(EncoderCall::Count)] = { "pipeline", "vertex buffers", "index buffer", "descriptor sets", "push constants" };
+
+    EncoderStats stats;
+    for (auto& frame : m_frameCommands)
+    {
+        for (auto& encoder : frame.encoders)
         {
-            throw std::runtime_error("Could not create drawFence fence");
+            stats += encoder.getStats();
         }
     }
+
+    std::cout << "Command encoder state changes (issued/elided)" << std::endl;
+    for (size_t call = 0; call < size_t(EncoderCall::Count); call++)
+    {
+        std::cout << "  " << callNames[call] << ": " << stats.issued[call] << "/" << stats.elided[call] << std::endl;
+    }
 }
+
+void VulkanRenderer::printMeshMemory()
+{
+    // Meshes only own ranges of the pool so they never show up as owners in the memory report
+    std::cout << "Geometry pool: " << m_geometry.getUsedBytes() << " bytes used" << std::endl;
+    for (size_t i = 0; i < m_meshes.size(); i++)
+    {
+        std::cout << "  mesh " << i << ": " << m_meshes[i].getMemoryUsage() << " bytes ("
+            << m_meshes[i].getVertexCount() << " vertices, " << m_meshes[i].getIndexCount() << " indices)" << std::endl;
+    }
+}
+
+void VulkanRenderer::printMemoryReport()
+{
+    const MemoryTracker& tracker = m_allocator.getTracker();
+    const VkPhysicalDeviceMemoryProperties& props = m_allocator.getMemoryTypes().getProperties();
+
+    std::cout << "Device memory" << std::endl;
+    for (uint32_t heap = 0; heap < props.memoryHeapCount; heap++)
+    {
+        MemoryUsage usage = tracker.getHeapUsage(heap);
+        if (usage.created == 0) continue;
+
+        std::cout << "  heap " << heap << ((props.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : " (host)") << ": "
+            << usage.bytes << " bytes in " << usage.count << " resources, peak " << usage.peakBytes << " bytes in " << usage.peakCount << ", "
+            << usage.created << " created, " << usage.destroyed << " destroyed" << std::endl;
+    }
+    for (auto& owner : tracker.getOwnerUsage())
+    {
+        std::cout << "  " << owner.first << ": " << owner.second.bytes << " bytes, peak " << owner.second.peakBytes << " bytes" << std::endl;
+    }
+
+    for (auto& resource : tracker.getLiveResources())
+    {
+        std::cout << "  Leaked " << (resource.type == TrackedType::Buffer ? "buffer " : "image ") << std::hex << resource.handle << std::dec
+            << " (" << resource.owner << ", #" << resource.serial << "): " << resource.size << " bytes in heap " << resource.heap << std::endl;
+    }
+}
\ No newline at end of file
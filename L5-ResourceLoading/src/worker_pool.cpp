@@ -0,0 +1,96 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+
+void WorkerPool::init(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    m_stop = false;
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        m_threads.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+void WorkerPool::destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+    m_threads.clear();
+}
+
+uint32_t WorkerPool::getThreadCount() const
+{
+    return static_cast<uint32_t>(m_threads.size());
+}
+
+void WorkerPool::run(uint32_t count, const std::function<void(uint32_t)>& task)
+{
+    if (count == 0) return;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_count = count;
+    m_next = 0;
+    m_finished = 0;
+    m_error = nullptr;
+    m_wake.notify_all();
+
+    m_done.wait(lock, [this]() { return m_finished == m_count; });
+
+    // Nothing left to pick up until the next run
+    m_count = 0;
+    m_next = 0;
+    m_task = nullptr;
+
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void WorkerPool::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wake.wait(lock, [this]() { return m_stop || m_next < m_count; });
+        if (m_stop) return;
+
+        uint32_t index = m_next++;
+        const std::function<void(uint32_t)>& task = *m_task;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try
+        {
+            task(index);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        if (error && !m_error)
+        {
+            m_error = error;
+        }
+        if (++m_finished == m_count)
+        {
+            m_done.notify_all();
+        }
+    }
+}